@@ -0,0 +1,1022 @@
+/*
+MIO BENCHMARK SUITE
+File: bench.c
+Description: Reproducible workloads comparing MIO against stdio (FILE*) and raw
+             read()/write() system calls across file, request and MIO buffer sizes
+Features: sequential read/write, char-at-a-time, tokenizing, line reading and
+          small random reads; throughput, read/write syscall counts and per-op
+          latency percentiles; text, JSON or CSV output
+Author: Subhajit Halder
+*/
+
+#define _GNU_SOURCE
+#include "mio.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#define BENCH_MAXLIST 16	// max entries in --sizes / --chunks / --bufsizes
+#define BENCH_PATTERN 65536	// size of the generated data pattern
+#define LAT_SAMPLES 65536	// max latency samples kept per case
+#define RAND_MAXREADS 100000	// cap on reads issued by rand_read
+#define RAND_MAXCHUNK 4096	// rand_read only runs for small requests
+#define RAW_BYTE_LIMIT (1 << 20)	// 1-byte syscall loops only up to 1 MiB
+// Longest generated word: mygets() stops at MBSIZE - 1 bytes and fscanf at 63,
+// so every tokens backend sees exactly the same tokens
+#define BENCH_MAXWORD (MBSIZE - 1 < 12 ? MBSIZE - 1 : 12)
+
+#define FMT_TEXT 0
+#define FMT_JSON 1
+#define FMT_CSV 2
+
+// Sampled per-operation latency recorder
+struct lat_rec {
+    uint64_t *ns;		// samples in nanoseconds
+    size_t n, cap;		// samples used / allocated
+    uint64_t every, tick;	// sample one op out of every 'every'
+};
+
+// State handed to one run of a workload
+struct bench_ctx {
+    const char *path;	// input file (already generated)
+    const char *out;	// output file for write workloads
+    size_t fsize;	// file size in bytes
+    size_t chunk;	// request size for chunked workloads
+    size_t mbuf;	// MIO buffer size set with mysetvbuf() (0 - MBSIZE)
+    uint64_t seed;	// seed for random offsets
+    struct lat_rec lat;
+};
+
+// One implementation of one workload
+struct bench_case {
+    const char *impl;		// "mio", "stdio" or "raw"
+    const char *workload;	// workload name
+    int chunked;		// iterate over request sizes
+    size_t op_bytes;		// approx bytes per op when not chunked
+    size_t max_fsize;		// skip larger files (0 - no limit)
+    int random;			// small reads at random offsets
+    long (*run)(struct bench_ctx *);
+};
+
+// Aggregated result of one case
+struct bench_result {
+    const struct bench_case *bc;
+    size_t fsize, chunk, mbuf;
+    long bytes;
+    double secs;
+    long syscalls;
+    uint64_t p50, p90, p99, p999, max;
+};
+
+static char pattern[BENCH_PATTERN];
+
+// Monotonic clock in nanoseconds
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64* - deterministic across platforms and libcs
+static uint64_t rng_next(uint64_t *s) {
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545F4914F6CDD1Dull;
+}
+
+static void lat_push(struct lat_rec *r, uint64_t ns) {
+    if (r->n < r->cap) {
+        r->ns[r->n++] = ns;
+    }
+}
+
+// Time one out of every r->every operations
+#define LAT_BEGIN(r) uint64_t lat_t0_ = ((r)->tick++ % (r)->every == 0) ? now_ns() : 0
+#define LAT_END(r) do { if (lat_t0_) { lat_push((r), now_ns() - lat_t0_); } } while (0)
+
+// Read and write syscall counters of this process from /proc/self/io
+static long count_syscalls(void) {
+    FILE *f = fopen("/proc/self/io", "r");
+    if (!f) {
+        return -1;
+    }
+    char line[128];
+    long total = 0;
+    while (fgets(line, sizeof(line), f)) {
+        long v;
+        if (sscanf(line, "syscr: %ld", &v) == 1 || sscanf(line, "syscw: %ld", &v) == 1) {
+            total += v;
+        }
+    }
+    fclose(f);
+    return total;
+}
+
+// Fill the pattern with whitespace separated words and short lines
+static void make_pattern(uint64_t seed) {
+    uint64_t s = seed ? seed : 1;
+    size_t pos = 0;
+    int words = 0;
+    while (pos < BENCH_PATTERN) {
+        int wlen = 1 + (int)(rng_next(&s) % BENCH_MAXWORD);
+        for (int i = 0; i < wlen && pos < BENCH_PATTERN; i++) {
+            pattern[pos++] = 'a' + (char)(rng_next(&s) % 26);
+        }
+        if (pos < BENCH_PATTERN) {
+            pattern[pos++] = (++words % 10 == 0) ? MNLINE : MSPACE;
+        }
+    }
+    pattern[BENCH_PATTERN - 1] = MNLINE;
+}
+
+// Write the input file used by the read workloads
+static int make_file(const char *path, size_t fsize) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t done = 0;
+    while (done < fsize) {
+        size_t n = fsize - done < BENCH_PATTERN ? fsize - done : BENCH_PATTERN;
+        ssize_t w = write(fd, pattern, n);
+        if (w <= 0) {
+            close(fd);
+            return -1;
+        }
+        done += (size_t)w;
+    }
+    close(fd);
+    return 0;
+}
+
+// Copy 'n' bytes of the pattern starting at logical offset 'off'
+static const char *pattern_at(size_t off, size_t n, char *tmp) {
+    off %= BENCH_PATTERN;
+    if (off + n <= BENCH_PATTERN) {
+        return pattern + off;
+    }
+    for (size_t i = 0; i < n; i++) {
+        tmp[i] = pattern[(off + i) % BENCH_PATTERN];
+    }
+    return tmp;
+}
+
+static size_t rand_reads(const struct bench_ctx *c) {
+    size_t n = c->fsize / c->chunk;
+    if (n < 16) {
+        n = 16;
+    }
+    if (n > RAND_MAXREADS) {
+        n = RAND_MAXREADS;
+    }
+    return n;
+}
+
+// ---------------------------------------------------------------- MIO
+
+// myopen() with the buffer size under test
+static MIO *bench_myopen(struct bench_ctx *c, const char *name, int mode) {
+    MIO *m = myopen(name, mode);
+    if (m && c->mbuf && mysetvbuf(m, MIO_FULLBUF, c->mbuf) < 0) {
+        myclose(m);
+        return NULL;
+    }
+    return m;
+}
+
+static long mio_seq_read(struct bench_ctx *c) {
+    MIO *m = bench_myopen(c, c->path, MODE_R);
+    char *buf = malloc(c->chunk);
+    long total = 0;
+    if (!m || !buf) {
+        goto out;
+    }
+    for (;;) {
+        LAT_BEGIN(&c->lat);
+        int n = myread(m, buf, (int)c->chunk);
+        LAT_END(&c->lat);
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+out:
+    free(buf);
+    if (m) {
+        myclose(m);
+    }
+    return total;
+}
+
+static long mio_seq_write(struct bench_ctx *c) {
+    MIO *m = bench_myopen(c, c->out, MODE_WT);
+    char *tmp = malloc(c->chunk);
+    long total = 0;
+    if (!m || !tmp) {
+        goto out;
+    }
+    while ((size_t)total < c->fsize) {
+        size_t n = c->fsize - total < c->chunk ? c->fsize - total : c->chunk;
+        const char *p = pattern_at(total, n, tmp);
+        LAT_BEGIN(&c->lat);
+        int w = mywrite(m, p, (int)n);
+        LAT_END(&c->lat);
+        if (w < 0) {
+            break;
+        }
+        total += w;
+    }
+out:
+    free(tmp);
+    if (m && myclose(m) < 0) {
+        total = -1;
+    }
+    return total;
+}
+
+static long mio_getc(struct bench_ctx *c) {
+    MIO *m = bench_myopen(c, c->path, MODE_R);
+    long total = 0;
+    char ch;
+    if (!m) {
+        return -1;
+    }
+    for (;;) {
+        LAT_BEGIN(&c->lat);
+        int n = mygetc(m, &ch);
+        LAT_END(&c->lat);
+        if (n != 1) {
+            break;
+        }
+        total++;
+    }
+    myclose(m);
+    return total;
+}
+
+static long mio_putc(struct bench_ctx *c) {
+    MIO *m = bench_myopen(c, c->out, MODE_WT);
+    long total = 0;
+    if (!m) {
+        return -1;
+    }
+    while ((size_t)total < c->fsize) {
+        LAT_BEGIN(&c->lat);
+        int n = myputc(m, pattern[total % BENCH_PATTERN]);
+        LAT_END(&c->lat);
+        if (n != 1) {
+            break;
+        }
+        total++;
+    }
+    if (myclose(m) < 0) {
+        total = -1;
+    }
+    return total;
+}
+
+static long mio_tokens(struct bench_ctx *c) {
+    MIO *m = bench_myopen(c, c->path, MODE_R);
+    long total = 0;
+    if (!m) {
+        return -1;
+    }
+    for (;;) {
+        int len;
+        LAT_BEGIN(&c->lat);
+        char *s = mygets(m, &len);
+        LAT_END(&c->lat);
+        if (!s) {
+            break;
+        }
+        total += len;
+        free(s);
+    }
+    myclose(m);
+    return total;
+}
+
+// Same tokens through mygets_batch(): 256 per call into a reused arena
+static long mio_tokens_batch(struct bench_ctx *c) {
+    MIO *m = bench_myopen(c, c->path, MODE_R);
+    static char mem[1 << 16];
+    struct mio_token tok[256];
+    struct mio_arena arena = { mem, sizeof(mem), 0 };
+    long total = 0;
+    if (!m) {
+        return -1;
+    }
+    for (;;) {
+        arena.used = 0;
+        LAT_BEGIN(&c->lat);
+        ssize_t n = mygets_batch(m, tok, 256, &arena);
+        LAT_END(&c->lat);
+        if (n <= 0) {
+            break;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            total += (long)tok[i].len;
+        }
+    }
+    myclose(m);
+    return total;
+}
+
+static long mio_lines(struct bench_ctx *c) {
+    MIO *m = bench_myopen(c, c->path, MODE_R);
+    long total = 0;
+    if (!m) {
+        return -1;
+    }
+    for (;;) {
+        size_t len = 0;
+        LAT_BEGIN(&c->lat);
+        char *line = mygetline(m, &len);
+        LAT_END(&c->lat);
+        if (!line) {
+            break;
+        }
+        total += (long)len + 1;
+        free(line);
+    }
+    myclose(m);
+    return total;
+}
+
+static long mio_rand_read(struct bench_ctx *c) {
+    MIO *m = bench_myopen(c, c->path, MODE_R);
+    char *buf = malloc(c->chunk);
+    uint64_t s = c->seed;
+    long total = 0;
+    if (!m || !buf) {
+        goto out;
+    }
+    size_t reads = rand_reads(c);
+    size_t span = c->fsize > c->chunk ? c->fsize - c->chunk : 1;
+    for (size_t i = 0; i < reads; i++) {
+        off_t off = (off_t)(rng_next(&s) % span);
+        LAT_BEGIN(&c->lat);
+        ssize_t n = 0;
+        if (myseek(m, off, SEEK_SET) == off) {
+            n = myread64(m, buf, c->chunk);
+        }
+        LAT_END(&c->lat);
+        if (n > 0) {
+            total += (long)n;
+        }
+    }
+out:
+    free(buf);
+    if (m) {
+        myclose(m);
+    }
+    return total;
+}
+
+// ---------------------------------------------------------------- stdio
+
+static long stdio_seq_read(struct bench_ctx *c) {
+    FILE *f = fopen(c->path, "r");
+    char *buf = malloc(c->chunk);
+    long total = 0;
+    if (!f || !buf) {
+        goto out;
+    }
+    for (;;) {
+        LAT_BEGIN(&c->lat);
+        size_t n = fread(buf, 1, c->chunk, f);
+        LAT_END(&c->lat);
+        if (n == 0) {
+            break;
+        }
+        total += (long)n;
+    }
+out:
+    free(buf);
+    if (f) {
+        fclose(f);
+    }
+    return total;
+}
+
+static long stdio_seq_write(struct bench_ctx *c) {
+    FILE *f = fopen(c->out, "w");
+    char *tmp = malloc(c->chunk);
+    long total = 0;
+    if (!f || !tmp) {
+        goto out;
+    }
+    while ((size_t)total < c->fsize) {
+        size_t n = c->fsize - total < c->chunk ? c->fsize - total : c->chunk;
+        const char *p = pattern_at(total, n, tmp);
+        LAT_BEGIN(&c->lat);
+        size_t w = fwrite(p, 1, n, f);
+        LAT_END(&c->lat);
+        if (w != n) {
+            break;
+        }
+        total += (long)w;
+    }
+out:
+    free(tmp);
+    if (f && fclose(f) != 0) {
+        total = -1;
+    }
+    return total;
+}
+
+static long stdio_getc(struct bench_ctx *c) {
+    FILE *f = fopen(c->path, "r");
+    long total = 0;
+    if (!f) {
+        return -1;
+    }
+    for (;;) {
+        LAT_BEGIN(&c->lat);
+        int ch = getc(f);
+        LAT_END(&c->lat);
+        if (ch == EOF) {
+            break;
+        }
+        total++;
+    }
+    fclose(f);
+    return total;
+}
+
+static long stdio_putc(struct bench_ctx *c) {
+    FILE *f = fopen(c->out, "w");
+    long total = 0;
+    if (!f) {
+        return -1;
+    }
+    while ((size_t)total < c->fsize) {
+        LAT_BEGIN(&c->lat);
+        int r = putc(pattern[total % BENCH_PATTERN], f);
+        LAT_END(&c->lat);
+        if (r == EOF) {
+            break;
+        }
+        total++;
+    }
+    if (fclose(f) != 0) {
+        total = -1;
+    }
+    return total;
+}
+
+static long stdio_tokens(struct bench_ctx *c) {
+    FILE *f = fopen(c->path, "r");
+    char tok[64];
+    long total = 0;
+    if (!f) {
+        return -1;
+    }
+    for (;;) {
+        LAT_BEGIN(&c->lat);
+        int r = fscanf(f, "%63s", tok);
+        LAT_END(&c->lat);
+        if (r != 1) {
+            break;
+        }
+        total += (long)strlen(tok);
+    }
+    fclose(f);
+    return total;
+}
+
+static long stdio_lines(struct bench_ctx *c) {
+    FILE *f = fopen(c->path, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    long total = 0;
+    if (!f) {
+        return -1;
+    }
+    for (;;) {
+        LAT_BEGIN(&c->lat);
+        ssize_t n = getline(&line, &cap, f);
+        LAT_END(&c->lat);
+        if (n < 0) {
+            break;
+        }
+        total += (long)n;
+    }
+    free(line);
+    fclose(f);
+    return total;
+}
+
+static long stdio_rand_read(struct bench_ctx *c) {
+    FILE *f = fopen(c->path, "r");
+    char *buf = malloc(c->chunk);
+    uint64_t s = c->seed;
+    long total = 0;
+    if (!f || !buf) {
+        goto out;
+    }
+    size_t reads = rand_reads(c);
+    size_t span = c->fsize > c->chunk ? c->fsize - c->chunk : 1;
+    for (size_t i = 0; i < reads; i++) {
+        long off = (long)(rng_next(&s) % span);
+        LAT_BEGIN(&c->lat);
+        size_t n = 0;
+        if (fseek(f, off, SEEK_SET) == 0) {
+            n = fread(buf, 1, c->chunk, f);
+        }
+        LAT_END(&c->lat);
+        total += (long)n;
+    }
+out:
+    free(buf);
+    if (f) {
+        fclose(f);
+    }
+    return total;
+}
+
+// ---------------------------------------------------------------- raw syscalls
+
+static long raw_seq_read(struct bench_ctx *c) {
+    int fd = open(c->path, O_RDONLY);
+    char *buf = malloc(c->chunk);
+    long total = 0;
+    if (fd < 0 || !buf) {
+        goto out;
+    }
+    for (;;) {
+        LAT_BEGIN(&c->lat);
+        ssize_t n = read(fd, buf, c->chunk);
+        LAT_END(&c->lat);
+        if (n <= 0) {
+            break;
+        }
+        total += (long)n;
+    }
+out:
+    free(buf);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return total;
+}
+
+static long raw_seq_write(struct bench_ctx *c) {
+    int fd = open(c->out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    char *tmp = malloc(c->chunk);
+    long total = 0;
+    if (fd < 0 || !tmp) {
+        goto out;
+    }
+    while ((size_t)total < c->fsize) {
+        size_t n = c->fsize - total < c->chunk ? c->fsize - total : c->chunk;
+        const char *p = pattern_at(total, n, tmp);
+        LAT_BEGIN(&c->lat);
+        ssize_t w = write(fd, p, n);
+        LAT_END(&c->lat);
+        if (w <= 0) {
+            break;
+        }
+        total += (long)w;
+    }
+out:
+    free(tmp);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return total;
+}
+
+static long raw_getc(struct bench_ctx *c) {
+    int fd = open(c->path, O_RDONLY);
+    long total = 0;
+    char ch;
+    if (fd < 0) {
+        return -1;
+    }
+    for (;;) {
+        LAT_BEGIN(&c->lat);
+        ssize_t n = read(fd, &ch, 1);
+        LAT_END(&c->lat);
+        if (n != 1) {
+            break;
+        }
+        total++;
+    }
+    close(fd);
+    return total;
+}
+
+static long raw_putc(struct bench_ctx *c) {
+    int fd = open(c->out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    long total = 0;
+    if (fd < 0) {
+        return -1;
+    }
+    while ((size_t)total < c->fsize) {
+        LAT_BEGIN(&c->lat);
+        ssize_t n = write(fd, &pattern[total % BENCH_PATTERN], 1);
+        LAT_END(&c->lat);
+        if (n != 1) {
+            break;
+        }
+        total++;
+    }
+    close(fd);
+    return total;
+}
+
+// Hand-rolled 64 KiB buffer scanner: the best case a caller could write
+static long raw_scan(struct bench_ctx *c, int lines) {
+    int fd = open(c->path, O_RDONLY);
+    char *buf = malloc(BENCH_PATTERN);
+    long total = 0;
+    if (fd < 0 || !buf) {
+        goto out;
+    }
+    size_t have = 0;
+    int eof = 0;
+    while (!eof || have > 0) {
+        if (!eof && have < BENCH_PATTERN) {
+            ssize_t n = read(fd, buf + have, BENCH_PATTERN - have);
+            if (n <= 0) {
+                eof = 1;
+            } else {
+                have += (size_t)n;
+            }
+        }
+        size_t pos = 0;
+        for (;;) {
+            LAT_BEGIN(&c->lat);
+            size_t start = pos, end;
+            if (lines) {
+                char *nl = memchr(buf + pos, MNLINE, have - pos);
+                end = nl ? (size_t)(nl - buf) : have;
+            } else {
+                while (start < have && M_ISWS(buf[start])) start++;
+                end = start;
+                while (end < have && !M_ISWS(buf[end])) end++;
+            }
+            LAT_END(&c->lat);
+            // the item may continue past the buffer: refill first
+            if (end == have && !eof && have < BENCH_PATTERN) {
+                break;
+            }
+            if (end > start) {
+                total += (long)(end - start);
+            }
+            if (lines && end < have) {
+                total++;
+            }
+            pos = end < have ? end + 1 : have;
+            if (pos >= have) {
+                break;
+            }
+        }
+        memmove(buf, buf + pos, have - pos);
+        have -= pos;
+        if (eof && pos == 0) {
+            break;
+        }
+    }
+out:
+    free(buf);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return total;
+}
+
+static long raw_tokens(struct bench_ctx *c) {
+    return raw_scan(c, 0);
+}
+
+static long raw_lines(struct bench_ctx *c) {
+    return raw_scan(c, 1);
+}
+
+static long raw_rand_read(struct bench_ctx *c) {
+    int fd = open(c->path, O_RDONLY);
+    char *buf = malloc(c->chunk);
+    uint64_t s = c->seed;
+    long total = 0;
+    if (fd < 0 || !buf) {
+        goto out;
+    }
+    size_t reads = rand_reads(c);
+    size_t span = c->fsize > c->chunk ? c->fsize - c->chunk : 1;
+    for (size_t i = 0; i < reads; i++) {
+        off_t off = (off_t)(rng_next(&s) % span);
+        LAT_BEGIN(&c->lat);
+        ssize_t n = pread(fd, buf, c->chunk, off);
+        LAT_END(&c->lat);
+        if (n > 0) {
+            total += (long)n;
+        }
+    }
+out:
+    free(buf);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return total;
+}
+
+// ---------------------------------------------------------------- driver
+
+static const struct bench_case cases[] = {
+    { "mio",   "seq_read",  1, 0,  0, 0, mio_seq_read },
+    { "stdio", "seq_read",  1, 0,  0, 0, stdio_seq_read },
+    { "raw",   "seq_read",  1, 0,  0, 0, raw_seq_read },
+    { "mio",   "seq_write", 1, 0,  0, 0, mio_seq_write },
+    { "stdio", "seq_write", 1, 0,  0, 0, stdio_seq_write },
+    { "raw",   "seq_write", 1, 0,  0, 0, raw_seq_write },
+    { "mio",   "getc",      0, 1,  0, 0, mio_getc },
+    { "stdio", "getc",      0, 1,  0, 0, stdio_getc },
+    { "raw",   "getc",      0, 1,  RAW_BYTE_LIMIT, 0, raw_getc },
+    { "mio",   "putc",      0, 1,  0, 0, mio_putc },
+    { "stdio", "putc",      0, 1,  0, 0, stdio_putc },
+    { "raw",   "putc",      0, 1,  RAW_BYTE_LIMIT, 0, raw_putc },
+    { "mio",   "tokens",    0, 7,  0, 0, mio_tokens },
+    { "stdio", "tokens",    0, 7,  0, 0, stdio_tokens },
+    { "raw",   "tokens",    0, 7,  0, 0, raw_tokens },
+    { "mio",   "tok_batch", 0, 7 * 256, 0, 0, mio_tokens_batch },
+    { "mio",   "lines",     0, 70, 0, 0, mio_lines },
+    { "stdio", "lines",     0, 70, 0, 0, stdio_lines },
+    { "raw",   "lines",     0, 70, 0, 0, raw_lines },
+    { "mio",   "rand_read", 1, 0,  0, 1, mio_rand_read },
+    { "stdio", "rand_read", 1, 0,  0, 1, stdio_rand_read },
+    { "raw",   "rand_read", 1, 0,  0, 1, raw_rand_read },
+};
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const struct lat_rec *r, double p) {
+    if (r->n == 0) {
+        return 0;
+    }
+    size_t i = (size_t)(p * (double)(r->n - 1) + 0.5);
+    return r->ns[i];
+}
+
+// Run one case 'reps' times; reports the median time of the repetitions
+static int run_case(const struct bench_case *bc, const char *path, const char *out,
+                    size_t fsize, size_t chunk, size_t mbuf, int reps, uint64_t seed,
+                    struct bench_result *res) {
+    struct bench_ctx c = { path, out, fsize, chunk, mbuf, seed, { 0 } };
+    size_t ops = bc->random ? rand_reads(&c)
+                            : bc->chunked ? fsize / chunk : fsize / bc->op_bytes;
+    c.lat.cap = LAT_SAMPLES;
+    c.lat.ns = malloc(sizeof(uint64_t) * LAT_SAMPLES);
+    c.lat.every = (uint64_t)(ops * (size_t)reps / LAT_SAMPLES) + 1;
+    double *secs = malloc(sizeof(double) * (size_t)reps);
+    if (!c.lat.ns || !secs) {
+        free(c.lat.ns);
+        free(secs);
+        return -1;
+    }
+
+    memset(res, 0, sizeof(*res));
+    res->bc = bc;
+    res->fsize = fsize;
+    res->chunk = bc->chunked ? chunk : 0;
+    res->mbuf = mbuf;
+    for (int i = 0; i < reps; i++) {
+        long sc0 = count_syscalls();
+        uint64_t t0 = now_ns();
+        long bytes = bc->run(&c);
+        uint64_t t1 = now_ns();
+        long sc1 = count_syscalls();
+        if (bytes < 0) {
+            free(c.lat.ns);
+            free(secs);
+            return -1;
+        }
+        secs[i] = (double)(t1 - t0) / 1e9;
+        res->bytes = bytes;
+        // the counter read itself costs one read syscall
+        res->syscalls = (sc0 < 0 || sc1 < 0) ? -1 : sc1 - sc0 - 1;
+    }
+    qsort(secs, (size_t)reps, sizeof(double), cmp_double);
+    res->secs = secs[reps / 2];
+    qsort(c.lat.ns, c.lat.n, sizeof(uint64_t), cmp_u64);
+    res->p50 = percentile(&c.lat, 0.50);
+    res->p90 = percentile(&c.lat, 0.90);
+    res->p99 = percentile(&c.lat, 0.99);
+    res->p999 = percentile(&c.lat, 0.999);
+    res->max = c.lat.n ? c.lat.ns[c.lat.n - 1] : 0;
+    free(c.lat.ns);
+    free(secs);
+    return 0;
+}
+
+static double mb_per_s(const struct bench_result *r) {
+    return r->secs > 0 ? (double)r->bytes / r->secs / (1024.0 * 1024.0) : 0.0;
+}
+
+struct bench_config_view {
+    uint64_t seed;
+    int reps;
+};
+
+static void print_header(int format, const struct bench_config_view *v) {
+    if (format == FMT_JSON) {
+        printf("{\n  \"seed\": %llu,\n  \"reps\": %d,\n  \"results\": [\n",
+               (unsigned long long)v->seed, v->reps);
+    } else if (format == FMT_CSV) {
+        printf("impl,workload,file_size,chunk,mio_bufsize,bytes,seconds,mb_per_s,"
+               "syscalls,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+    } else {
+        printf("MIO benchmark (seed=%llu, reps=%d, median time)\n",
+               (unsigned long long)v->seed, v->reps);
+        printf("%-6s %-10s %10s %7s %7s %10s %12s %9s %9s %9s %9s\n",
+               "impl", "workload", "file", "chunk", "mbuf", "MB/s", "syscalls",
+               "p50ns", "p90ns", "p99ns", "p999ns");
+    }
+}
+
+static void print_result(int format, const struct bench_result *r, int first) {
+    if (format == FMT_JSON) {
+        printf("%s    {\"impl\": \"%s\", \"workload\": \"%s\", \"file_size\": %zu, "
+               "\"chunk\": %zu, \"mio_bufsize\": %zu, \"bytes\": %ld, \"seconds\": %.6f, \"mb_per_s\": %.2f, "
+               "\"syscalls\": %ld, \"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, "
+               "\"p999_ns\": %llu, \"max_ns\": %llu}",
+               first ? "" : ",\n", r->bc->impl, r->bc->workload, r->fsize, r->chunk,
+               r->mbuf, r->bytes, r->secs, mb_per_s(r), r->syscalls,
+               (unsigned long long)r->p50, (unsigned long long)r->p90,
+               (unsigned long long)r->p99, (unsigned long long)r->p999,
+               (unsigned long long)r->max);
+    } else if (format == FMT_CSV) {
+        printf("%s,%s,%zu,%zu,%zu,%ld,%.6f,%.2f,%ld,%llu,%llu,%llu,%llu,%llu\n",
+               r->bc->impl, r->bc->workload, r->fsize, r->chunk, r->mbuf, r->bytes,
+               r->secs, mb_per_s(r), r->syscalls,
+               (unsigned long long)r->p50, (unsigned long long)r->p90,
+               (unsigned long long)r->p99, (unsigned long long)r->p999,
+               (unsigned long long)r->max);
+    } else {
+        printf("%-6s %-10s %10zu %7zu %7zu %10.2f %12ld %9llu %9llu %9llu %9llu\n",
+               r->bc->impl, r->bc->workload, r->fsize, r->chunk, r->mbuf, mb_per_s(r),
+               r->syscalls, (unsigned long long)r->p50, (unsigned long long)r->p90,
+               (unsigned long long)r->p99, (unsigned long long)r->p999);
+    }
+    fflush(stdout);
+}
+
+// Parse "64K,1M,16M" into a list of sizes
+static int parse_sizes(const char *s, size_t *out) {
+    int n = 0;
+    while (*s && n < BENCH_MAXLIST) {
+        char *end;
+        unsigned long long v = strtoull(s, &end, 10);
+        if (end == s) {
+            return -1;
+        }
+        if (*end == 'K' || *end == 'k') {
+            v <<= 10;
+            end++;
+        } else if (*end == 'M' || *end == 'm') {
+            v <<= 20;
+            end++;
+        } else if (*end == 'G' || *end == 'g') {
+            v <<= 30;
+            end++;
+        }
+        if (v == 0) {
+            return -1;
+        }
+        out[n++] = (size_t)v;
+        if (*end == ',') {
+            end++;
+        } else if (*end) {
+            return -1;
+        }
+        s = end;
+    }
+    return n;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [--json|--csv] [--sizes 64K,1M,16M] [--chunks 16,512,4096,65536]\n"
+            "          [--bufsizes 10,4K,64K] [--reps N] [--seed N] [--dir PATH] [--only WORKLOAD] [--impl NAME]\n"
+            "          [--cache SIZE]\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    size_t sizes[BENCH_MAXLIST] = { 64 << 10, 1 << 20, 16 << 20 };
+    size_t chunks[BENCH_MAXLIST] = { 16, 512, 4096, 65536 };
+    size_t bufsizes[BENCH_MAXLIST] = { MBSIZE, 4 << 10, 64 << 10 };
+    size_t cache[BENCH_MAXLIST] = { 0 };	// MIO block cache size, 0 - off
+    int nsizes = 3, nchunks = 4, nbufsizes = 3, ncache = 1, reps = 3, format = FMT_TEXT;
+    uint64_t seed = 42;
+    const char *dir = ".", *only = NULL, *impl = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (!strcmp(a, "--json")) {
+            format = FMT_JSON;
+        } else if (!strcmp(a, "--csv")) {
+            format = FMT_CSV;
+        } else if (!strcmp(a, "--sizes") && v) {
+            nsizes = parse_sizes(v, sizes);
+            i++;
+        } else if (!strcmp(a, "--chunks") && v) {
+            nchunks = parse_sizes(v, chunks);
+            i++;
+        } else if (!strcmp(a, "--bufsizes") && v) {
+            nbufsizes = parse_sizes(v, bufsizes);
+            i++;
+        } else if (!strcmp(a, "--reps") && v) {
+            reps = atoi(v);
+            i++;
+        } else if (!strcmp(a, "--seed") && v) {
+            seed = strtoull(v, NULL, 10);
+            i++;
+        } else if (!strcmp(a, "--dir") && v) {
+            dir = v;
+            i++;
+        } else if (!strcmp(a, "--only") && v) {
+            only = v;
+            i++;
+        } else if (!strcmp(a, "--impl") && v) {
+            impl = v;
+            i++;
+        } else if (!strcmp(a, "--cache") && v) {
+            ncache = parse_sizes(v, cache);
+            i++;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    // The block cache is process wide and set up once: one size per run
+    if (nsizes <= 0 || nchunks <= 0 || nbufsizes <= 0 || ncache != 1 || reps <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    char path[4096], out[4096];
+    snprintf(path, sizeof(path), "%s/mio_bench_in.%d", dir, (int)getpid());
+    snprintf(out, sizeof(out), "%s/mio_bench_out.%d", dir, (int)getpid());
+    make_pattern(seed);
+    if (cache[0] && mycache_init(cache[0]) < 0) {
+        fprintf(stderr, "failed to set up a %zu byte block cache\n", cache[0]);
+        return 1;
+    }
+
+    struct bench_config_view view = { seed, reps };
+    print_header(format, &view);
+    int first = 1, failed = 0;
+    for (int s = 0; s < nsizes; s++) {
+        if (make_file(path, sizes[s]) < 0) {
+            fprintf(stderr, "cannot create %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+        for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+            const struct bench_case *bc = &cases[k];
+            if ((only && strcmp(only, bc->workload)) || (impl && strcmp(impl, bc->impl))) {
+                continue;
+            }
+            if (bc->max_fsize && sizes[s] > bc->max_fsize) {
+                continue;
+            }
+            int nc = bc->chunked ? nchunks : 1;
+            int nb = strcmp(bc->impl, "mio") ? 1 : nbufsizes;
+            for (int j = 0; j < nc; j++) {
+                size_t chunk = bc->chunked ? chunks[j] : 1;
+                if (bc->random && (chunk > RAND_MAXCHUNK || chunk > sizes[s])) {
+                    continue;
+                }
+                for (int b = 0; b < nb; b++) {
+                    size_t mbuf = strcmp(bc->impl, "mio") ? 0 : bufsizes[b];
+                    struct bench_result r;
+                    if (run_case(bc, path, out, sizes[s], chunk, mbuf, reps, seed, &r) < 0) {
+                        fprintf(stderr, "%s/%s failed\n", bc->impl, bc->workload);
+                        failed = 1;
+                        continue;
+                    }
+                    print_result(format, &r, first);
+                    first = 0;
+                }
+            }
+        }
+    }
+    if (format == FMT_JSON) {
+        printf("\n  ]\n}\n");
+    }
+    unlink(path);
+    unlink(out);
+    return failed;
+}
@@ -9,6 +9,10 @@ Author: Subhajit Halder
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/socket.h>
 
 // Test utility functions
 void print_test_result(const char *test_name, int result) {
@@ -286,6 +290,1831 @@ int test_error_conditions() {
     return result;
 }
 
+// Only memory handles on this thread; its pool must be freed when it exits
+static void *memopen_thread(void *arg) {
+    char *region = arg;
+    MIO *a = mymemopen(region, 8, MODE_R);
+    myclose(a);
+    MIO *b = mymemopen(region, 8, MODE_R);
+    myclose(b);
+    return a == b ? region : NULL;
+}
+
+int test_handle_pool() {
+    printf("\nTesting Handle Pool\n");
+    
+    create_test_file("test_pool.txt", "pooled");
+    int result = 0;
+    
+    // A closed handle block should be reused by the next open
+    MIO *first = myopen("test_pool.txt", MODE_R);
+    if (!first) {
+        printf("Failed to open test file for reading\n");
+        return -1;
+    }
+    myclose(first);
+    MIO *second = myopen("test_pool.txt", MODE_R);
+    if (!second) {
+        printf("Failed to reopen test file\n");
+        return -1;
+    }
+    printf("Handle block reused: %s\n", first == second ? "yes" : "no");
+    if (first != second) result = -1;
+    
+    // Buffers live inside the block on their own cache lines
+    if (((unsigned long)second->rb % MIO_CACHELINE) || ((unsigned long)second->wb % MIO_CACHELINE)) {
+        printf("Buffers not cache-line aligned\n");
+        result = -1;
+    }
+    char buffer[10];
+    int bytes = myread(second, buffer, 6);
+    if (bytes != 6 || memcmp(buffer, "pooled", 6) != 0) result = -1;
+    myclose(second);
+    
+    // Many open/close cycles
+    for (int i = 0; i < 10000 && result == 0; i++) {
+        MIO *file = myopen("test_pool.txt", i % 2 ? MODE_R : MODE_WA);
+        if (!file) result = -1;
+        else myclose(file);
+    }
+    mypool_trim();
+    
+    // Buffer-less blocks are pooled too, and released at thread exit
+    char region[8] = "abcdefg";
+    pthread_t tid;
+    void *reused = NULL;
+    if (pthread_create(&tid, NULL, memopen_thread, region) != 0 || pthread_join(tid, &reused) != 0) {
+        result = -1;
+    }
+    printf("Memory handle block reused: %s\n", reused ? "yes" : "no");
+    if (!reused) result = -1;
+    
+    print_test_result("Handle Pool", result);
+    return result;
+}
+
+int test_direct_io() {
+    printf("\nTesting Direct I/O\n");
+    
+    int result = 0;
+    char data[8000];
+    for (int i = 0; i < (int)sizeof(data); i++) {
+        data[i] = 'a' + i % 26;
+    }
+    
+    // Unaligned length in truncate mode, with an explicit flush in between
+    MIO *file = myopen("test_direct.txt", MODE_WT | MODE_DIRECT);
+    if (!file) {
+        printf("Failed to open test file for direct writing\n");
+        return -1;
+    }
+    mywrite(file, data, 1234);
+    myflush(file);
+    struct stat st;
+    stat("test_direct.txt", &st);
+    printf("Size after flush: %ld (should be 1234)\n", (long)st.st_size);
+    if (st.st_size != 1234) result = -1;
+    mywrite(file, data + 1234, 5000 - 1234);
+    // The unaligned tail stays in wb, so a full-buffer reservation cannot fit
+    size_t room = file->wsize - 5000 % file->dalign;
+    char *p = mywrite_reserve(file, room + 1);
+    int err = errno;
+    if (p || err != EINVAL) result = -1;
+    p = mywrite_reserve(file, room);
+    if (!p) result = -1;
+    myclose(file);
+    
+    // Append continues from the unaligned tail
+    file = myopen("test_direct.txt", MODE_WA | MODE_DIRECT);
+    if (!file) {
+        printf("Failed to open test file for direct append\n");
+        return -1;
+    }
+    mywrite(file, data + 5000, 3000);
+    myclose(file);
+    stat("test_direct.txt", &st);
+    printf("Size after append: %ld (should be 8000)\n", (long)st.st_size);
+    if (st.st_size != 8000) result = -1;
+    
+    // Read back through aligned buffers
+    file = myopen("test_direct.txt", MODE_R | MODE_DIRECT);
+    if (!file) {
+        printf("Failed to open test file for direct reading\n");
+        return -1;
+    }
+    char buffer[8100];
+    int bytes = myread(file, buffer, sizeof(buffer));
+    printf("Read back %d bytes\n", bytes);
+    if (bytes != 8000 || memcmp(buffer, data, 8000) != 0) result = -1;
+    myclose(file);
+    
+    print_test_result("Direct I/O", result);
+    return result;
+}
+
+int test_memory_stream() {
+    printf("\nTesting Memory Streams\n");
+    
+    int result = 0;
+    
+    // Parse an in-memory payload with the same calls used for files
+    char payload[] = "  alpha beta\ngamma";
+    MIO *mem = mymemopen(payload, strlen(payload), MODE_R);
+    if (!mem) {
+        printf("Failed to open memory stream for reading\n");
+        return -1;
+    }
+    int len, count = 0;
+    char *str;
+    while ((str = mygets(mem, &len)) != NULL) {
+        printf("Token %d (length %d): '%s'\n", ++count, len, str);
+        free(str);
+    }
+    if (count != 3) result = -1;
+    myclose(mem);
+    
+    // Writes go straight into the region and stop when it is full
+    char region[16];
+    mem = mymemopen(region, sizeof(region), MODE_WT);
+    if (!mem) {
+        printf("Failed to open memory stream for writing\n");
+        return -1;
+    }
+    int written = mywrite(mem, "0123456789", 10);
+    int overflow = mywrite(mem, "abcdefghij", 10);
+    int full = myputc(mem, 'x');
+    printf("Written %d + %d bytes, then %d (should be 10 + 6, then -1)\n", written, overflow, full);
+    if (written != 10 || overflow != 6 || full != -1) result = -1;
+    if (memcmp(region, "0123456789abcdef", 16) != 0) result = -1;
+    myclose(mem);
+    
+    print_test_result("Memory Streams", result);
+    return result;
+}
+
+int test_memstream() {
+    printf("\nTesting Growable Memory Streams\n");
+    
+    int result = 0;
+    char *buf = NULL;
+    size_t size = 0;
+    MIO *mem = mymemstream(&buf, &size);
+    if (!mem) {
+        printf("Failed to open growable memory stream\n");
+        return -1;
+    }
+    
+    // Small writes first, then enough to move past the mmap threshold
+    myputs(mem, "header:", 7);
+    myputc(mem, ' ');
+    myflush(mem);
+    printf("After flush: '%s' (%zu bytes)\n", buf, size);
+    if (size != 8 || strcmp(buf, "header: ") != 0) result = -1;
+    
+    char line[64];
+    memset(line, 'x', sizeof(line));
+    for (int i = 0; i < 40000; i++) {
+        line[0] = 'a' + i % 26;
+        mywrite(mem, line, sizeof(line));
+    }
+    myclose(mem);
+    printf("After close: %zu bytes\n", size);
+    if (size != 8 + 40000 * sizeof(line) || buf[size] != '\0') result = -1;
+    if (buf[8 + 64 * 12345] != 'a' + 12345 % 26 || buf[9 + 64 * 12345] != 'x') result = -1;
+    mymemfree(buf);
+    
+    print_test_result("Growable Memory Streams", result);
+    return result;
+}
+
+#define PIPE_BYTES 300000
+
+// Reader side of the pipe test: counts bytes and checks the pattern
+static void *pipe_reader(void *arg) {
+    MIO *in = arg;
+    long total = 0, bad = 0;
+    char buffer[777];
+    int bytes;
+    usleep(20000);  // let the writer fill the pipe first
+    while ((bytes = myread(in, buffer, sizeof(buffer))) > 0) {
+        for (int i = 0; i < bytes; i++) {
+            if (buffer[i] != (char)('a' + (total + i) % 23)) bad++;
+        }
+        total += bytes;
+    }
+    myclose(in);
+    return (void *)(bad ? -1 : total);
+}
+
+int test_fdopen_pipe() {
+    printf("\nTesting myfdopen on a pipe\n");
+    
+    int fds[2];
+    if (pipe(fds) < 0) {
+        printf("Failed to create pipe\n");
+        return -1;
+    }
+    // A non-blocking write end makes the pipe report EAGAIN once it is full
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+    MIO *in = myfdopen(fds[0], MODE_R);
+    MIO *out = myfdopen(fds[1], MODE_WT);
+    if (!in || !out) {
+        printf("Failed to open pipe descriptors\n");
+        return -1;
+    }
+    
+    pthread_t reader;
+    pthread_create(&reader, NULL, pipe_reader, in);
+    char chunk[1000];
+    long sent = 0;
+    while (sent < PIPE_BYTES) {
+        for (int i = 0; i < (int)sizeof(chunk); i++) {
+            chunk[i] = 'a' + (sent + i) % 23;
+        }
+        if (mywrite(out, chunk, sizeof(chunk)) != (int)sizeof(chunk)) break;
+        sent += sizeof(chunk);
+    }
+    myclose(out);
+    void *received;
+    pthread_join(reader, &received);
+    printf("Sent %ld bytes, received %ld bytes\n", sent, (long)received);
+    
+    int result = ((long)received == PIPE_BYTES && sent == PIPE_BYTES) ? 0 : -1;
+    if (myfdopen(-1, MODE_R) != NULL) result = -1;
+    print_test_result("myfdopen on a pipe", result);
+    return result;
+}
+
+int test_nonblocking() {
+    printf("\nTesting Non-blocking Mode\n");
+    
+    int result = 0;
+    int fds[2];
+    if (pipe(fds) < 0) {
+        printf("Failed to create pipe\n");
+        return -1;
+    }
+    MIO *in = myfdopen(fds[0], MODE_R);
+    MIO *out = myfdopen(fds[1], MODE_WT);
+    if (!in || !out || mysetnonblock(in, 1) < 0 || mysetnonblock(out, 1) < 0) {
+        printf("Failed to set up non-blocking pipe\n");
+        return -1;
+    }
+    
+    // Nothing to read yet
+    char buffer[4096];
+    int bytes = myread(in, buffer, 5);
+    printf("Read from empty pipe: %d (should be %d)\n", bytes, MIO_WOULDBLOCK);
+    if (bytes != MIO_WOULDBLOCK || myinterest(in) != MIO_WANT_READ) result = -1;
+    
+    // Fill the pipe until the writer would block
+    long sent = 0;
+    memset(buffer, 'z', sizeof(buffer));
+    for (;;) {
+        int written = mywrite(out, buffer, 100);
+        if (written == MIO_WOULDBLOCK) break;
+        if (written < 0) { result = -1; break; }
+        sent += written;
+        if (written < 100) break;
+    }
+    printf("Writer accepted %ld bytes before blocking, interest %d\n", sent, myinterest(out));
+    if (!(myinterest(out) & MIO_WANT_WRITE)) result = -1;
+    
+    // Drain the reader and drive the writer until its buffer is empty
+    long received = 0;
+    int drive;
+    while ((drive = mydrive(out)) == MIO_WOULDBLOCK) {
+        while ((bytes = myread(in, buffer, sizeof(buffer))) > 0) received += bytes;
+    }
+    while ((bytes = myread(in, buffer, sizeof(buffer))) > 0) received += bytes;
+    printf("Received %ld of %ld bytes, interest now %d\n", received, sent, myinterest(out));
+    if (drive != 0 || received != sent || myinterest(out) != 0) result = -1;
+    
+    myclose(out);
+    myclose(in);
+    print_test_result("Non-blocking Mode", result);
+    return result;
+}
+
+int test_readv_writev() {
+    printf("\nTesting myreadv and mywritev\n");
+    
+    int result = 0;
+    MIO *file = myopen("test_vector.txt", MODE_WT);
+    if (!file) {
+        printf("Failed to open test file for writing\n");
+        return -1;
+    }
+    
+    // Small message: coalesced into the write buffer
+    char header[] = "HDR:", trailer[] = ";\n";
+    char body[5000];
+    for (int i = 0; i < (int)sizeof(body); i++) body[i] = 'A' + i % 26;
+    struct iovec small[3] = { { header, 4 }, { body, 3 }, { trailer, 2 } };
+    int written = mywritev(file, small, 3);
+    // Large message: pending data plus all segments in one writev
+    struct iovec large[3] = { { header, 4 }, { body, sizeof(body) }, { trailer, 2 } };
+    written += mywritev(file, large, 3);
+    myclose(file);
+    printf("Written %d bytes (should be %d)\n", written, 9 + 4 + (int)sizeof(body) + 2);
+    if (written != 9 + 4 + (int)sizeof(body) + 2) result = -1;
+    
+    file = myopen("test_vector.txt", MODE_R);
+    if (!file) {
+        printf("Failed to open test file for reading\n");
+        return -1;
+    }
+    char h1[4], b1[3], t1[2], h2[4], b2[5000], t2[2];
+    struct iovec in[6] = { { h1, 4 }, { b1, 3 }, { t1, 2 }, { h2, 4 }, { b2, sizeof(b2) }, { t2, 2 } };
+    int bytes = myreadv(file, in, 6);
+    printf("Read %d bytes back into 6 segments\n", bytes);
+    if (bytes != written || memcmp(h1, "HDR:", 4) || memcmp(b1, body, 3) || memcmp(t1, ";\n", 2) ||
+        memcmp(h2, "HDR:", 4) || memcmp(b2, body, sizeof(b2)) || memcmp(t2, ";\n", 2)) {
+        result = -1;
+    }
+    char ch;
+    if (mygetc(file, &ch) != -1) result = -1;
+    myclose(file);
+    
+    // A small myreadv between single reads keeps the rest of the buffer
+    file = myopen("test_vector.txt", MODE_R);
+    char d[1], r2[2], next[4];
+    struct iovec mid[2] = { { d, 1 }, { r2, 2 } };
+    int first = mygetc(file, &ch);
+    int mid_bytes = myreadv(file, mid, 2);
+    int rest = myread(file, next, 4);
+    printf("Mixed: %c %.1s%.2s %.4s at %lld (should be H DR: ABC; at 8)\n",
+           ch, d, r2, next, (long long)mytell(file));
+    if (first != 1 || mid_bytes != 3 || rest != 4 || ch != 'H' || d[0] != 'D' || memcmp(r2, "R:", 2) ||
+        memcmp(next, "ABC;", 4) || mytell(file) != 8) {
+        result = -1;
+    }
+    myclose(file);
+    
+    print_test_result("myreadv and mywritev", result);
+    return result;
+}
+
+static long file_size(const char *name) {
+    struct stat st;
+    return stat(name, &st) == 0 ? (long)st.st_size : -1;
+}
+
+int test_buffering_policies() {
+    printf("\nTesting Buffering Policies\n");
+    
+    int result = 0;
+    MIO *file = myopen("test_policy.txt", MODE_WT);
+    if (!file) {
+        printf("Failed to open test file for writing\n");
+        return -1;
+    }
+    
+    // Line buffered: nothing reaches the file until a newline is written
+    mysetvbuf(file, MIO_LINEBUF, 0);
+    mywrite(file, "abc", 3);
+    long before = file_size("test_policy.txt");
+    mywrite(file, "de\nf", 4);
+    long after = file_size("test_policy.txt");
+    printf("Line buffered: %ld then %ld bytes (should be 0 then 7)\n", before, after);
+    if (before != 0 || after != 7) result = -1;
+    
+    // Unbuffered: every write goes out immediately
+    mysetvbuf(file, MIO_NOBUF, 0);
+    myputc(file, 'g');
+    printf("Unbuffered: %ld bytes (should be 8)\n", file_size("test_policy.txt"));
+    if (file_size("test_policy.txt") != 8) result = -1;
+    
+    // Latency bounded with a larger buffer: flushed by the timer hook
+    mysetvbuf(file, MIO_FULLBUF, 4096);
+    mysetlatency(file, 1000);
+    mywrite(file, "0123456789abcdef", 16);
+    before = file_size("test_policy.txt");
+    int ticked = mytick(file);
+    usleep(3000);
+    ticked += mytick(file);
+    after = file_size("test_policy.txt");
+    printf("Latency bounded: %ld then %ld bytes after %d flush (should be 8 then 24 after 1)\n",
+           before, after, ticked);
+    if (before != 8 || after != 24 || ticked != 1) result = -1;
+    
+    // A writev that empties wb restarts the latency clock
+    mysetlatency(file, 20000);
+    myputc(file, 'h');
+    static char big[5000];
+    memset(big, 'v', sizeof(big));
+    struct iovec seg = { big, sizeof(big) };
+    mywritev(file, &seg, 1);
+    usleep(25000);
+    myputc(file, 'i');
+    after = file_size("test_policy.txt");
+    printf("After writev: %ld bytes (should be 5025, 'i' still buffered)\n", after);
+    if (after != 5025) result = -1;
+    
+    myclose(file);
+    print_test_result("Buffering Policies", result);
+    return result;
+}
+
+// Read what is available from a non-blocking pipe and check the pattern
+static long drain_pipe(int fd, long received, long *bad, int max) {
+    char buffer[4096];
+    int got;
+    while (max > 0 && (got = read(fd, buffer, max < (int)sizeof(buffer) ? max : (int)sizeof(buffer))) > 0) {
+        for (int i = 0; i < got; i++) {
+            if (buffer[i] != 'a' + (received + i) % 19) (*bad)++;
+        }
+        received += got;
+        max -= got;
+    }
+    return received;
+}
+
+int test_ring_buffer() {
+    printf("\nTesting Ring Write Buffer\n");
+    
+    int result = 0;
+    int fds[2];
+    if (pipe(fds) < 0) {
+        printf("Failed to create pipe\n");
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    MIO *out = myfdopen(fds[1], MODE_WT);
+    if (!out || mysetnonblock(out, 1) < 0 || mysetvbuf(out, MIO_FULLBUF, 10000) < 0) {
+        printf("Failed to set up pipe writer\n");
+        return -1;
+    }
+    
+    // Keep the pipe nearly full so flushes are partial and later writes wrap
+    // around the end of wb
+    char chunk[333];
+    long sent = 0, received = 0, bad = 0;
+    int wrapped = 0;
+    while (sent < 400000) {
+        for (int i = 0; i < (int)sizeof(chunk); i++) chunk[i] = 'a' + (sent + i) % 19;
+        int written = mywrite(out, chunk, sizeof(chunk));
+        if (written == MIO_WOULDBLOCK) written = 0;
+        if (written < 0) { result = -1; break; }
+        sent += written;
+        if (out->wh + out->ws > out->wsize) wrapped++;
+        if (written < (int)sizeof(chunk)) {
+            received = drain_pipe(fds[0], received, &bad, 5555);
+            mydrive(out);
+        }
+    }
+    while (mydrive(out) == MIO_WOULDBLOCK) {
+        received = drain_pipe(fds[0], received, &bad, 1 << 20);
+    }
+    myclose(out);
+    received = drain_pipe(fds[0], received, &bad, 1 << 20);
+    close(fds[0]);
+    printf("Sent %ld bytes, received %ld bytes, %ld out of order, wrapped: %s\n",
+           sent, received, bad, wrapped ? "yes" : "no");
+    if (sent != received || bad != 0 || !wrapped) result = -1;
+    
+    print_test_result("Ring Write Buffer", result);
+    return result;
+}
+
+int test_large_file() {
+    printf("\nTesting Large File Positions\n");
+    
+    int result = 0;
+    const off_t far = 5LL << 30;  // past the 32-bit limits, kept sparse
+    MIO *file = myopen("test_large.txt", MODE_WT);
+    if (!file) {
+        printf("Failed to open test file for writing\n");
+        return -1;
+    }
+    
+    // 64-bit writes and an absolute seek beyond 4 GB
+    mywrite64(file, "head", 4);
+    off_t at = myseek(file, far, SEEK_SET);
+    ssize_t put = myputs64(file, "tail-end", 8);
+    printf("Write position: %lld after %zd bytes (should be %lld after 8)\n",
+           (long long)mytell(file), put, (long long)far + 8);
+    if (at != far || put != 8 || mytell(file) != far + 8) result = -1;
+    myclose(file);
+    
+    file = myopen("test_large.txt", MODE_R);
+    if (!file) {
+        printf("Failed to open test file for reading\n");
+        return -1;
+    }
+    char buf[16] = {0};
+    ssize_t got = myread64(file, buf, 2);
+    off_t end = myseek(file, -8, SEEK_END);
+    got += myread64(file, buf + 2, 8);
+    printf("Read back: '%s', end seek %lld (should be 'hetail-end', %lld)\n",
+           buf, (long long)end, (long long)far);
+    if (got != 10 || end != far || strcmp(buf, "hetail-end") != 0) result = -1;
+    
+    // Seeking inside the buffered data only moves the cursor
+    myseek(file, -3, SEEK_CUR);
+    char c = 0;
+    mygetc(file, &c);
+    printf("Relative seek: '%c' at %lld (should be 'e' at %lld)\n",
+           c, (long long)mytell(file), (long long)far + 6);
+    if (c != 'e' || mytell(file) != far + 6) result = -1;
+    myclose(file);
+    
+    // Append handles report their position but cannot seek
+    file = myopen("test_large.txt", MODE_WA);
+    if (!file || mytell(file) != far + 8 || myseek(file, 0, SEEK_SET) != -1) result = -1;
+    if (file) myclose(file);
+    
+    print_test_result("Large File Positions", result);
+    return result;
+}
+
+static void *follow_writer(void *arg) {
+    usleep(50000);
+    int fd = open((const char *)arg, O_WRONLY | O_APPEND);
+    write(fd, "four\n", 5);
+    close(fd);
+    return NULL;
+}
+
+int test_tail_follow() {
+    printf("\nTesting Line Reading and Tail-Follow Mode\n");
+    
+    int result = 0;
+    size_t len = 0;
+    
+    // Lines longer than the buffer, and a last line without newline
+    create_test_file("test_follow.txt", "a line longer than MBSIZE\n\nend");
+    MIO *file = myopen("test_follow.txt", MODE_R);
+    if (!file) {
+        printf("Failed to open test file for reading\n");
+        return -1;
+    }
+    char *l1 = mygetline(file, &len);
+    char *l2 = mygetline(file, NULL);
+    char *l3 = mygetline(file, NULL);
+    char *l4 = mygetline(file, NULL);
+    printf("Lines: '%s' (%zu), '%s', '%s', %s (should be 'a line longer than MBSIZE' (25), '', 'end', NULL)\n",
+           l1 ? l1 : "NULL", len, l2 ? l2 : "NULL", l3 ? l3 : "NULL", l4 ? "not NULL" : "NULL");
+    if (!l1 || len != 25 || !l2 || *l2 || !l3 || strcmp(l3, "end") != 0 || l4) result = -1;
+    free(l1);
+    free(l2);
+    free(l3);
+    free(l4);
+    myclose(file);
+    
+    // Follow without waiting: a partial line stays buffered until completed
+    create_test_file("test_follow.txt", "one\ntw");
+    file = myopen("test_follow.txt", MODE_R | MODE_FOLLOW);
+    if (!file) {
+        printf("Failed to open test file in follow mode\n");
+        return -1;
+    }
+    mysetfollow(file, 0);
+    char *line = mygetline(file, NULL);
+    char *none = mygetline(file, NULL);
+    int again = (errno == EAGAIN);
+    int fd = open("test_follow.txt", O_WRONLY | O_APPEND);
+    write(fd, "o\n", 2);
+    close(fd);
+    char *two = mygetline(file, NULL);
+    printf("Non-blocking follow: '%s', %s, '%s' (should be 'one', EAGAIN, 'two')\n",
+           line ? line : "NULL", (!none && again) ? "EAGAIN" : "?", two ? two : "NULL");
+    if (!line || strcmp(line, "one") != 0 || none || !again || !two || strcmp(two, "two") != 0) result = -1;
+    free(line);
+    free(none);
+    free(two);
+    
+    // Blocking follow: woken by inotify when another thread appends
+    mysetfollow(file, 2000);
+    pthread_t writer;
+    pthread_create(&writer, NULL, follow_writer, "test_follow.txt");
+    line = mygetline(file, NULL);
+    pthread_join(writer, NULL);
+    printf("Blocking follow: '%s' (should be 'four')\n", line ? line : "NULL");
+    if (!line || strcmp(line, "four") != 0) result = -1;
+    free(line);
+    
+    // Rotation: the file is renamed and a new one created under the name
+    rename("test_follow.txt", "test_follow.txt.1");
+    create_test_file("test_follow.txt", "five\n");
+    line = mygetline(file, NULL);
+    printf("After rotation: '%s' at %lld (should be 'five' at 5)\n",
+           line ? line : "NULL", (long long)mytell(file));
+    if (!line || strcmp(line, "five") != 0 || mytell(file) != 5) result = -1;
+    free(line);
+    
+    // Truncation: reading restarts at the beginning
+    create_test_file("test_follow.txt", "6\n");
+    line = mygetline(file, NULL);
+    printf("After truncation: '%s' (should be '6')\n", line ? line : "NULL");
+    if (!line || strcmp(line, "6") != 0) result = -1;
+    free(line);
+    
+    myclose(file);
+    unlink("test_follow.txt.1");
+    print_test_result("Tail-Follow Mode", result);
+    return result;
+}
+
+int test_reverse_lines() {
+    printf("\nTesting Reverse Line Reading\n");
+    
+    int result = 0;
+    
+    // Enough lines to span several MIO_REVERSE_BSIZE blocks
+    MIO *out = myopen("test_reverse.txt", MODE_WT);
+    if (!out) {
+        printf("Failed to open test file for writing\n");
+        return -1;
+    }
+    char text[32];
+    for (int i = 1; i <= 20000; i++) {
+        int n = snprintf(text, sizeof(text), "line %d\n", i);
+        mywrite(out, text, n);
+    }
+    myclose(out);
+    
+    MIO *file = myopen("test_reverse.txt", MODE_R);
+    if (!file) {
+        printf("Failed to open test file for reading\n");
+        return -1;
+    }
+    myseek(file, 0, SEEK_END);
+    int count = 0, ordered = 1;
+    char *line;
+    while ((line = mygetline_reverse(file, NULL)) != NULL) {
+        snprintf(text, sizeof(text), "line %d", 20000 - count);
+        if (strcmp(line, text) != 0) ordered = 0;
+        count++;
+        free(line);
+    }
+    printf("Reverse lines: %d, in order: %s (should be 20000, yes)\n", count, ordered ? "yes" : "no");
+    if (count != 20000 || !ordered) result = -1;
+    
+    // Forward reading continues from where the reverse cursor stopped
+    myseek(file, 0, SEEK_END);
+    free(mygetline_reverse(file, NULL));
+    line = mygetline_reverse(file, NULL);
+    char *again = mygetline(file, NULL);
+    printf("Forward after reverse: '%s' then '%s' (should be 'line 19999' twice)\n",
+           line ? line : "NULL", again ? again : "NULL");
+    if (!line || !again || strcmp(line, "line 19999") != 0 || strcmp(again, line) != 0) result = -1;
+    free(line);
+    free(again);
+    myclose(file);
+    
+    // Empty lines, and no empty line for a trailing newline
+    char region[] = "a\n\nb\n";
+    file = mymemopen(region, strlen(region), MODE_R);
+    myseek(file, 0, SEEK_END);
+    char *l1 = mygetline_reverse(file, NULL);
+    char *l2 = mygetline_reverse(file, NULL);
+    char *l3 = mygetline_reverse(file, NULL);
+    char *l4 = mygetline_reverse(file, NULL);
+    printf("Memory stream: '%s', '%s', '%s', %s (should be 'b', '', 'a', NULL)\n",
+           l1 ? l1 : "NULL", l2 ? l2 : "NULL", l3 ? l3 : "NULL", l4 ? "not NULL" : "NULL");
+    if (!l1 || strcmp(l1, "b") != 0 || !l2 || *l2 || !l3 || strcmp(l3, "a") != 0 || l4) result = -1;
+    free(l1);
+    free(l2);
+    free(l3);
+    free(l4);
+    myclose(file);
+    
+    print_test_result("Reverse Line Reading", result);
+    return result;
+}
+
+// Read a whole file through MIO and return a simple checksum (-1 on error)
+static long read_sum(const char *name) {
+    MIO *file = myopen(name, MODE_R);
+    if (!file) {
+        return -1;
+    }
+    char buf[4096];
+    long sum = 0;
+    int n;
+    while ((n = myread(file, buf, sizeof(buf))) > 0) {
+        for (int i = 0; i < n; i++) {
+            sum = (sum * 31 + (unsigned char)buf[i]) % 1000000007;
+        }
+    }
+    myclose(file);
+    return sum;
+}
+
+static void *cache_reader(void *arg) {
+    *(long *)arg = read_sum("test_cache.txt");
+    return NULL;
+}
+
+int test_block_cache() {
+    printf("\nTesting Shared Block Cache\n");
+    
+    int result = 0;
+    char data[1000];
+    for (int i = 0; i < (int)sizeof(data); i++) {
+        data[i] = 'a' + i % 23;
+    }
+    MIO *out = myopen("test_cache.txt", MODE_WT);
+    if (!out) {
+        printf("Failed to open test file for writing\n");
+        return -1;
+    }
+    for (int i = 0; i < 300; i++) {
+        mywrite(out, data, sizeof(data));  // 300000 bytes, 5 cache pages
+    }
+    myclose(out);
+    long plain = read_sum("test_cache.txt");
+    
+    // Two handles on the same file: the second one is served from the cache
+    mycache_init(1 << 20);
+    struct mio_cache_stats st;
+    long first = read_sum("test_cache.txt");
+    mycache_stats(&st);
+    long misses = st.misses;
+    long second = read_sum("test_cache.txt");
+    mycache_stats(&st);
+    printf("Cached reads: %ld misses, then %ld more (should be 5, then 0)\n",
+           misses, st.misses - misses);
+    if (first != plain || second != plain || misses != 5 || st.misses != misses || st.hits == 0) result = -1;
+    
+    // Concurrent readers share the pages
+    long sums[2] = {0, 0};
+    pthread_t readers[2];
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&readers[i], NULL, cache_reader, &sums[i]);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    printf("Concurrent readers: %s (should be same data)\n",
+           (sums[0] == plain && sums[1] == plain) ? "same data" : "different data");
+    if (sums[0] != plain || sums[1] != plain) result = -1;
+    
+    // A rewritten file has a new mtime, so its stale pages are not used
+    usleep(10000);
+    create_test_file("test_cache.txt", "replaced");
+    MIO *file = myopen("test_cache.txt", MODE_R);
+    char buf[16] = {0};
+    int n = file ? myread(file, buf, sizeof(buf) - 1) : -1;
+    printf("After rewrite: '%s' (should be 'replaced')\n", buf);
+    if (n != 8 || strcmp(buf, "replaced") != 0) result = -1;
+    if (file) myclose(file);
+    
+    // A bound below one page per shard is refused rather than exceeded
+    int refused = mycache_init(MIO_CACHE_MIN - 1);
+    int err = errno;
+    if (refused != -1 || err != EINVAL) result = -1;
+    
+    // The smallest cache (one page per shard) evicts while staying correct
+    mycache_init(MIO_CACHE_MIN);
+    out = myopen("test_cache.txt", MODE_WT);
+    for (int i = 0; out && i < 2000; i++) {
+        mywrite(out, data, sizeof(data));
+    }
+    if (out) myclose(out);
+    mycache_init(0);
+    plain = read_sum("test_cache.txt");
+    mycache_init(MIO_CACHE_MIN);
+    first = read_sum("test_cache.txt");
+    mycache_stats(&st);
+    printf("Bounded cache: %ld pages, %ld evictions (should be at most %d, some)\n",
+           st.pages, st.evictions, MIO_CACHE_SHARDS);
+    if (first != plain || st.pages > MIO_CACHE_SHARDS || st.evictions == 0) result = -1;
+    mycache_init(0);
+    
+    print_test_result("Shared Block Cache", result);
+    return result;
+}
+
+// The 100003-byte digest test stream, in uneven pieces
+static void write_digest_data(MIO *file) {
+    char buf[777];
+    for (int i = 0; i < 100003; i += (int)sizeof(buf)) {
+        int n = 100003 - i < (int)sizeof(buf) ? 100003 - i : (int)sizeof(buf);
+        for (int k = 0; k < n; k++) {
+            buf[k] = (char)(((i + k) * 7 + (i + k) / 13) % 256);
+        }
+        mywrite(file, buf, n);
+    }
+}
+
+int test_digests() {
+    printf("\nTesting Streaming Digests\n");
+    
+    int result = 0;
+    uint32_t crc = 0;
+    uint64_t hash = 0;
+    
+    // Reference values: CRC32C("123456789") and XXH64("abc")
+    create_test_file("test_digest.txt", "123456789");
+    MIO *file = myopen("test_digest.txt", MODE_R);
+    char buf[1000];
+    mysetdigest(file, MIO_DIGEST_CRC32C);
+    while (myread(file, buf, 4) > 0) {
+    }
+    mydigest(file, &crc, NULL);
+    myclose(file);
+    create_test_file("test_digest.txt", "abc");
+    file = myopen("test_digest.txt", MODE_R);
+    mysetdigest(file, MIO_DIGEST_XXH64);
+    while (myread(file, buf, 2) > 0) {
+    }
+    mydigest(file, NULL, &hash);
+    myclose(file);
+    printf("Check values: %08x %016llx (should be e3069283 44bc2cf5ad770999)\n",
+           crc, (unsigned long long)hash);
+    if (crc != 0xe3069283 || hash != 0x44bc2cf5ad770999ULL) result = -1;
+    
+    // Writer digests include data still in wb; the reader sees the same bytes
+    file = myopen("test_digest.txt", MODE_WT);
+    mysetvbuf(file, MIO_FULLBUF, 4096);
+    mysetdigest(file, MIO_DIGEST_CRC32C | MIO_DIGEST_XXH64);
+    write_digest_data(file);
+    mydigest(file, &crc, &hash);
+    myclose(file);
+    uint32_t rcrc = 0;
+    uint64_t rhash = 0;
+    file = myopen("test_digest.txt", MODE_R);
+    mysetdigest(file, MIO_DIGEST_CRC32C | MIO_DIGEST_XXH64);
+    while (myread(file, buf, 333) > 0) {
+    }
+    mydigest(file, &rcrc, &rhash);
+    myclose(file);
+    printf("100003 bytes: write %08x %016llx, read %08x %016llx (should be 598fdbeb 5c808ee27a927e38)\n",
+           crc, (unsigned long long)hash, rcrc, (unsigned long long)rhash);
+    if (crc != 0x598fdbeb || hash != 0x5c808ee27a927e38ULL || rcrc != crc || rhash != hash) result = -1;
+    
+    // Filtered handles digest the raw stream: the same values whether data is
+    // pending, held by workers or flushed, and on the filtered reader
+    for (int workers = 0; workers <= 3; workers += 3) {
+        uint32_t before = 0, after = 0;
+        file = myopen("test_digest.txt", MODE_WT);
+        mypushfilter(file, &mio_filter_lz);
+        if (workers > 0) mysetworkers(file, workers);
+        mysetdigest(file, MIO_DIGEST_CRC32C);
+        write_digest_data(file);
+        mydigest(file, &before, NULL);
+        myflush(file);
+        mydigest(file, &after, NULL);
+        myclose(file);
+        file = myopen("test_digest.txt", MODE_R);
+        mypushfilter(file, &mio_filter_lz);
+        mysetdigest(file, MIO_DIGEST_CRC32C);
+        while (myread(file, buf, 333) > 0) {
+        }
+        mydigest(file, &rcrc, NULL);
+        myclose(file);
+        printf("Filtered, %d workers: %08x before flush, %08x after, %08x read\n",
+               workers, before, after, rcrc);
+        if (before != 0x598fdbeb || after != before || rcrc != before) result = -1;
+    }
+    
+    print_test_result("Streaming Digests", result);
+    return result;
+}
+
+int test_filters() {
+    printf("\nTesting Filter Stack\n");
+    
+    int result = 0;
+    char line[128], buf[1000];
+    
+    // Compressible log lines shrink on disk and come back byte for byte
+    MIO *file = myopen("test_filter.txt", MODE_WT);
+    if (!file || mypushfilter(file, &mio_filter_lz) < 0 || mypushfilter(file, &mio_filter_crc) < 0) {
+        printf("Failed to set up filtered writer\n");
+        if (file) myclose(file);
+        return -1;
+    }
+    long raw = 0;
+    for (int i = 0; i < 20000; i++) {
+        int n = snprintf(line, sizeof(line), "2026-10-16 12:00:%02d INFO request %d served in %d us\n",
+                         i % 60, i, i % 977);
+        mywrite(file, line, n);
+        raw += n;
+    }
+    if (mywrite(file, "tail", 4) != 4) result = -1;
+    myflush(file);	// a small explicit frame in the middle of the stream
+    mywrite(file, "end\n", 4);
+    raw += 8;
+    myclose(file);
+    long disk = file_size("test_filter.txt");
+    printf("Compressed %ld bytes to %ld (should be at most a third)\n", raw, disk);
+    if (disk <= 0 || disk * 3 > raw) result = -1;
+    
+    file = myopen("test_filter.txt", MODE_R);
+    mypushfilter(file, &mio_filter_lz);
+    mypushfilter(file, &mio_filter_crc);
+    long got = 0, bad = 0, lines = 0;
+    char *l;
+    while ((l = mygetline(file, NULL)) != NULL) {
+        snprintf(line, sizeof(line), "2026-10-16 12:00:%02d INFO request %ld served in %ld us",
+                 (int)(lines % 60), lines, lines % 977);
+        if (lines < 20000 ? strcmp(l, line) != 0 : strcmp(l, "tailend") != 0) bad++;
+        got += (long)strlen(l) + 1;
+        lines++;
+        free(l);
+    }
+    myclose(file);
+    printf("Read back %ld lines, %ld bytes, %ld mismatches (should be 20001, %ld, 0)\n",
+           lines, got, bad, raw);
+    if (lines != 20001 || got != raw || bad != 0) result = -1;
+    
+    // Incompressible data round trips through oversized frames
+    file = myopen("test_filter.txt", MODE_WT);
+    mypushfilter(file, &mio_filter_lz);
+    unsigned x = 12345;
+    for (int i = 0; i < 300; i++) {
+        for (int k = 0; k < (int)sizeof(buf); k++) {
+            x = x * 1103515245 + 12345;
+            buf[k] = (char)(x >> 16);
+        }
+        mywrite(file, buf, sizeof(buf));
+    }
+    myclose(file);
+    file = myopen("test_filter.txt", MODE_R);
+    mypushfilter(file, &mio_filter_lz);
+    x = 12345;
+    bad = 0;
+    got = 0;
+    int n;
+    while ((n = myread(file, buf, 333)) > 0) {
+        for (int k = 0; k < n; k++) {
+            x = x * 1103515245 + 12345;
+            bad += buf[k] != (char)(x >> 16);
+        }
+        got += n;
+        // filters cannot be pushed once data is buffered
+        if (got == 333 && mypushfilter(file, &mio_filter_crc) != -1) bad++;
+    }
+    myclose(file);
+    printf("Incompressible: %ld bytes, %ld mismatches (should be 300000, 0)\n", got, bad);
+    if (got != 300000 || bad != 0) result = -1;
+    
+    // A flipped byte is caught by the checksum filter
+    file = myopen("test_filter.txt", MODE_WT);
+    mypushfilter(file, &mio_filter_crc);
+    myputs(file, "checked frame\n", 14);
+    myclose(file);
+    int fd = open("test_filter.txt", O_RDWR);
+    if (fd < 0 || pwrite(fd, "X", 1, MIO_FRAME_HDR + 2) != 1) result = -1;
+    if (fd >= 0) close(fd);
+    file = myopen("test_filter.txt", MODE_R);
+    mypushfilter(file, &mio_filter_crc);
+    n = myread(file, buf, sizeof(buf));
+    int err = errno;
+    printf("Corrupted frame read returned %d (should be -1, EBADMSG)\n", n);
+    if (n != -1 || err != EBADMSG) result = -1;
+    myclose(file);
+    
+    print_test_result("Filter Stack", result);
+    return result;
+}
+
+static long write_log(const char *name, int workers) {
+    MIO *file = myopen(name, MODE_WT);
+    if (!file || mypushfilter(file, &mio_filter_lz) < 0 || mypushfilter(file, &mio_filter_crc) < 0 ||
+        (workers > 0 && mysetworkers(file, workers) < 0)) {
+        if (file) myclose(file);
+        return -1;
+    }
+    char line[128];
+    long raw = 0;
+    for (int i = 0; i < 200000; i++) {
+        int n = snprintf(line, sizeof(line), "%d,%d,event-%d,%s\n", i, i * 31 % 1000,
+                         i % 17, i % 5 ? "ok" : "retry");
+        mywrite(file, line, n);
+        raw += n;
+        if (i == 100000) myflush(file);	// waits for every queued frame
+    }
+    return myclose(file) == 0 ? raw : -1;
+}
+
+int test_parallel_compression() {
+    printf("\nTesting Parallel Compression\n");
+    
+    int result = 0;
+    
+    // Frames are encoded deterministically, so the file does not depend on
+    // the number of workers
+    long raw = write_log("test_filter.txt", 0);
+    long raw4 = write_log("test_parallel.txt", 4);
+    long size = file_size("test_filter.txt"), size4 = file_size("test_parallel.txt");
+    FILE *a = fopen("test_filter.txt", "rb"), *b = fopen("test_parallel.txt", "rb");
+    long diff = 0;
+    if (a && b) {
+        int ca, cb;
+        do {
+            ca = fgetc(a);
+            cb = fgetc(b);
+            diff += ca != cb;
+        } while (ca != EOF && cb != EOF);
+    }
+    if (a) fclose(a);
+    if (b) fclose(b);
+    printf("1 thread: %ld bytes -> %ld, 4 workers: %ld bytes -> %ld, %ld differences (should be equal, 0)\n",
+           raw, size, raw4, size4, diff);
+    if (raw <= 0 || raw != raw4 || size != size4 || diff != 0 || !a || !b) result = -1;
+    
+    MIO *file = myopen("test_parallel.txt", MODE_R);
+    mypushfilter(file, &mio_filter_lz);
+    mypushfilter(file, &mio_filter_crc);
+    char buf[4096];
+    long got = 0;
+    int n;
+    while ((n = myread(file, buf, sizeof(buf))) > 0) {
+        got += n;
+    }
+    myclose(file);
+    printf("Read back %ld bytes (should be %ld)\n", got, raw);
+    if (got != raw) result = -1;
+    
+    // Workers need a filtered writer
+    file = myopen("test_parallel.txt", MODE_WT);
+    if (mysetworkers(file, 2) != -1) result = -1;
+    mypushfilter(file, &mio_filter_lz);
+    if (mysetworkers(file, 0) != -1 || mysetworkers(file, 2) != 0) result = -1;
+    if (mypushfilter(file, &mio_filter_crc) != -1) result = -1;
+    myclose(file);
+    
+    print_test_result("Parallel Compression", result);
+    return result;
+}
+
+struct block_scan {
+    MIO *file;
+    size_t first, step;
+    long bytes, lines, bad;
+};
+
+static void *block_decoder(void *arg) {
+    struct block_scan *scan = arg;
+    static __thread char buf[MIO_FILTER_BSIZE];
+    size_t n = mynblocks(scan->file);
+    for (size_t i = scan->first; i < n; i += scan->step) {
+        struct mio_block info;
+        ssize_t got = mypreadblock(scan->file, i, buf, sizeof(buf));
+        if (got < 0 || myblockinfo(scan->file, i, &info) < 0) {
+            scan->bad++;
+            continue;
+        }
+        long lines = 0;
+        for (ssize_t k = 0; k < got; k++) {
+            lines += buf[k] == '\n';
+        }
+        scan->bad += (size_t)lines != info.records;
+        scan->bytes += got;
+        scan->lines += lines;
+    }
+    return NULL;
+}
+
+// A filter the container can name but not set up by itself
+static size_t xor_bound(void *ctx, size_t n) {
+    (void)ctx;
+    return n;
+}
+
+static ssize_t xor_code(void *ctx, const char *src, size_t n, char *dst, size_t cap) {
+    (void)ctx;
+    if (n > cap) return -1;
+    for (size_t i = 0; i < n; i++) dst[i] = (char)(src[i] ^ 0x5A);
+    return (ssize_t)n;
+}
+
+static const struct mio_filter xor_filter = { "xor", NULL, xor_bound, xor_code, xor_code };
+
+int test_indexed_container() {
+    printf("\nTesting Block-Indexed Container\n");
+    
+    int result = 0;
+    char line[64];
+    
+    MIO *file = myopen("test_indexed.txt", MODE_WT | MODE_INDEXED);
+    if (!file || mypushfilter(file, &mio_filter_lz) < 0 || mysetworkers(file, 2) < 0) {
+        printf("Failed to open indexed container for writing\n");
+        if (file) myclose(file);
+        return -1;
+    }
+    long raw = 0, target = 0;
+    for (int i = 0; i < 100000; i++) {
+        if (i == 54321) target = raw;
+        int n = snprintf(line, sizeof(line), "line %d\n", i);
+        mywrite(file, line, n);
+        raw += n;
+    }
+    myclose(file);
+    
+    // The container names its filters: the reader sets up lz by itself
+    file = myopen("test_indexed.txt", MODE_R | MODE_INDEXED);
+    if (!file || mypushfilter(file, &mio_filter_lz) != -1) {
+        printf("Failed to open indexed container for reading\n");
+        if (file) myclose(file);
+        return -1;
+    }
+    size_t blocks = mynblocks(file), records = 0;
+    struct mio_block info;
+    for (size_t i = 0; i < blocks && myblockinfo(file, i, &info) == 0; i++) {
+        records += info.records;
+    }
+    printf("Index: %zu blocks, %zu records (should be several, 100000)\n", blocks, records);
+    if (blocks < 2 || records != 100000) result = -1;
+    
+    // Sequential reading stops at the index
+    long lines = 0;
+    char *l, *last = NULL;
+    while ((l = mygetline(file, NULL)) != NULL) {
+        free(last);
+        last = l;
+        lines++;
+    }
+    printf("Sequential: %ld lines, last '%s' (should be 100000, line 99999)\n", lines, last ? last : "");
+    if (lines != 100000 || !last || strcmp(last, "line 99999") != 0) result = -1;
+    free(last);
+    
+    // Seeking anywhere goes through the frame holding the offset
+    off_t at = myseek(file, target, SEEK_SET);
+    l = mygetline(file, NULL);
+    printf("Seek to %ld: '%s' (should be line 54321)\n", (long)at, l ? l : "");
+    if (at != target || !l || strcmp(l, "line 54321") != 0) result = -1;
+    free(l);
+    if (myseek(file, 0, SEEK_END) != raw || myread(file, line, 1) > 0) result = -1;
+    
+    // A block read through the handle matches the same block decoded by pread
+    static char block[MIO_FILTER_BSIZE];
+    myblockinfo(file, blocks / 2, &info);
+    at = myseekblock(file, blocks / 2);
+    ssize_t got = mypreadblock(file, blocks / 2, block, sizeof(block));
+    if (at != info.rawoff || got != (ssize_t)info.rawlen ||
+        myread(file, line, 32) != 32 || memcmp(line, block, 32) != 0) result = -1;
+    
+    // Parallel scan of all blocks
+    pthread_t tids[4];
+    struct block_scan scans[4];
+    for (int i = 0; i < 4; i++) {
+        scans[i] = (struct block_scan){ file, (size_t)i, 4, 0, 0, 0 };
+        pthread_create(&tids[i], NULL, block_decoder, &scans[i]);
+    }
+    long bytes = 0, bad = 0;
+    lines = 0;
+    for (int i = 0; i < 4; i++) {
+        pthread_join(tids[i], NULL);
+        bytes += scans[i].bytes;
+        lines += scans[i].lines;
+        bad += scans[i].bad;
+    }
+    printf("Parallel scan: %ld bytes, %ld lines, %ld errors (should be %ld, 100000, 0)\n",
+           bytes, lines, bad, raw);
+    if (bytes != raw || lines != 100000 || bad != 0) result = -1;
+    myclose(file);
+    
+    // A custom filter in the stack must be supplied by the reader, in order
+    file = myopen("test_indexed.txt", MODE_WT | MODE_INDEXED);
+    mypushfilter(file, &mio_filter_crc);
+    mypushfilter(file, &xor_filter);
+    mypushfilter(file, &mio_filter_lz);
+    mywrite(file, "custom stack\n", 13);
+    myclose(file);
+    file = myopen("test_indexed.txt", MODE_R | MODE_INDEXED);
+    int early = file ? myread(file, line, 6) : 0;
+    int wrong = file ? mypushfilter(file, &mio_filter_lz) : 0;
+    int right = file ? mypushfilter(file, &xor_filter) : -1;
+    l = file ? mygetline(file, NULL) : NULL;
+    printf("Custom stack: read %d, wrong filter %d, right %d, '%s' (should be -1 -1 0 custom stack)\n",
+           early, wrong, right, l ? l : "");
+    if (early != -1 || wrong != -1 || right != 0 || !l || strcmp(l, "custom stack") != 0) result = -1;
+    free(l);
+    if (file) myclose(file);
+    
+    // Unknown container flags are refused
+    int fd = open("test_indexed.txt", O_RDWR);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || pwrite(fd, "\001", 1, st.st_size - 16) != 1) result = -1;
+    if (fd >= 0) close(fd);
+    file = myopen("test_indexed.txt", MODE_R | MODE_INDEXED);
+    if (file) {
+        result = -1;
+        myclose(file);
+    }
+    
+    // Plain files are not containers
+    file = myopen("test_read.txt", MODE_R | MODE_INDEXED);
+    if (file) {
+        result = -1;
+        myclose(file);
+    }
+    
+    print_test_result("Block-Indexed Container", result);
+    return result;
+}
+
+int test_records() {
+    printf("\nTesting Record Framing\n");
+    
+    int result = 0;
+    static char big[300000];
+    size_t sizes[] = { 0, 1, 127, 128, 16383, 16384, sizeof(big) - 100, 5 };
+    int count = (int)(sizeof(sizes) / sizeof(sizes[0]));
+    for (size_t i = 0; i < sizeof(big); i++) {
+        big[i] = (char)(i * 31 + i / 7);
+    }
+    
+    MIO *file = myopen("test_records.txt", MODE_WT);
+    if (!file) {
+        printf("Failed to open test file for writing\n");
+        return -1;
+    }
+    mysetrecordcrc(file, 1);
+    for (int round = 0; round < 100; round++) {
+        for (int i = 0; i < count; i++) {
+            if (mywriterecord(file, big + round, sizes[i]) != (ssize_t)sizes[i]) result = -1;
+        }
+    }
+    myclose(file);
+    
+    file = myopen("test_records.txt", MODE_R);
+    mysetvbuf(file, MIO_FULLBUF, 65536);
+    mysetrecordcrc(file, 1);
+    const void *p;
+    size_t len;
+    int n = 0, bad = 0, views = 0, rc;
+    while ((rc = myreadrecord(file, &p, &len)) == 1) {
+        int round = n / count, i = n % count;
+        bad += len != sizes[i] || memcmp(p, big + round, len) != 0;
+        // records that fit the buffer are read in place
+        views += (const char *)p >= file->rb && (const char *)p < file->rb + file->rsize;
+        n++;
+    }
+    myclose(file);
+    printf("Read %d records, %d mismatches, %d in rb, end %d (should be %d, 0, %d, 0)\n",
+           n, bad, views, rc, 100 * count, 100 * (count - 1));
+    if (n != 100 * count || bad != 0 || views != 100 * (count - 1) || rc != 0) result = -1;
+    
+    // A flipped payload byte fails the checksum, and so does a cut record
+    file = myopen("test_records.txt", MODE_WT);
+    mysetrecordcrc(file, 1);
+    mywriterecord(file, "first", 5);
+    mywriterecord(file, "second record", 13);
+    myclose(file);
+    int fd = open("test_records.txt", O_RDWR);
+    for (int damage = 0; damage < 2; damage++) {
+        // the second record's payload starts at offset 1 + 5 + 4 + 1
+        if (fd < 0 || (damage == 0 ? pwrite(fd, "X", 1, 13) != 1 : ftruncate(fd, 24) < 0)) result = -1;
+        file = myopen("test_records.txt", MODE_R);
+        mysetrecordcrc(file, 1);
+        int first = myreadrecord(file, &p, &len);
+        int second = myreadrecord(file, &p, &len);
+        int err = errno;
+        myclose(file);
+        printf("Damaged stream: %d then %d (should be 1 then -1, EBADMSG)\n", first, second);
+        if (first != 1 || second != -1 || err != EBADMSG) result = -1;
+    }
+    if (fd >= 0) close(fd);
+    
+    // A short record on a blocking socket is returned while the peer stays open
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return -1;
+    MIO *tx = myfdopen(sv[0], MODE_WT), *rx = myfdopen(sv[1], MODE_R);
+    mywriterecord(tx, "hi", 2);
+    myflush(tx);
+    alarm(5);  // a hang here fails the suite
+    int got_short = myreadrecord(rx, &p, &len);
+    alarm(0);
+    printf("Socket: %d, %zu bytes (should be 1, 2)\n", got_short, len);
+    if (got_short != 1 || len != 2 || memcmp(p, "hi", 2) != 0) result = -1;
+    myclose(rx);
+    myclose(tx);
+    
+    // A large record arriving in pieces on a non-blocking pipe
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+    char rec[1 + 100];
+    rec[0] = 100;
+    for (int i = 1; i <= 100; i++) rec[i] = (char)('a' + i % 26);
+    MIO *in = myfdopen(fds[0], MODE_R);
+    mysetnonblock(in, 1);
+    int w1 = write(fds[1], rec, 41) == 41;
+    int r1 = myreadrecord(in, &p, &len);
+    int w2 = write(fds[1], rec + 41, 60) == 60 && write(fds[1], "\002hi", 3) == 3;
+    int r2 = myreadrecord(in, &p, &len);
+    int big_ok = r2 == 1 && len == 100 && memcmp(p, rec + 1, 100) == 0;
+    int r3 = myreadrecord(in, &p, &len);
+    int small_ok = r3 == 1 && len == 2 && memcmp(p, "hi", 2) == 0;
+    int r4 = myreadrecord(in, &p, &len);
+    close(fds[1]);
+    int r5 = myreadrecord(in, &p, &len);
+    myclose(in);
+    printf("Pipe: %d %d %d %d %d (should be %d 1 1 %d 0)\n", r1, r2, r3, r4, r5, MIO_WOULDBLOCK, MIO_WOULDBLOCK);
+    if (!w1 || !w2 || r1 != MIO_WOULDBLOCK || !big_ok || !small_ok || r4 != MIO_WOULDBLOCK || r5 != 0) result = -1;
+    
+    print_test_result("Record Framing", result);
+    return result;
+}
+
+int test_reserve_commit() {
+    printf("\nTesting Reserve and Commit\n");
+    
+    int result = 0;
+    static char expect[200000];
+    size_t elen = 0;
+    
+    // Encode straight into wb, mixed with plain writes so the ring wraps
+    MIO *file = myopen("test_reserve.txt", MODE_WT);
+    if (!file) {
+        printf("Failed to open test file for writing\n");
+        return -1;
+    }
+    mysetvbuf(file, MIO_FULLBUF, 100);
+    for (int i = 0; i < 5000; i++) {
+        char *p = mywrite_reserve(file, 40);
+        if (!p) {
+            result = -1;
+            break;
+        }
+        int n = snprintf(p, 40, "record %d;", i);
+        memcpy(expect + elen, p, (size_t)n);
+        elen += (size_t)n;
+        if (mywrite_commit(file, (size_t)n) < 0) result = -1;
+        if (i % 3 == 0) {
+            mywrite(file, "abcde", 5);
+            memcpy(expect + elen, "abcde", 5);
+            elen += 5;
+        }
+    }
+    // A reservation larger than wb grows it; commits are bounded by it
+    char *p = mywrite_reserve(file, 1000);
+    if (!p || mywrite_commit(file, 1001) != -1) result = -1;
+    if (p) {
+        memset(p, 'z', 1000);
+        memset(expect + elen, 'z', 1000);
+        elen += 1000;
+        if (mywrite_commit(file, 1000) < 0) result = -1;
+    }
+    myclose(file);
+    
+    static char got[200000];
+    file = myopen("test_reserve.txt", MODE_R);
+    ssize_t n = myread64(file, got, sizeof(got));
+    myclose(file);
+    printf("Committed %zu bytes, read back %zd (should match)\n", elen, n);
+    if (n != (ssize_t)elen || memcmp(got, expect, elen) != 0) result = -1;
+    
+    // A fixed memory region cannot give more than it has left
+    char mem[16];
+    file = mymemopen(mem, sizeof(mem), MODE_WT);
+    p = mywrite_reserve(file, 10);
+    if (!p || mywrite_commit(file, 10) < 0 || mywrite_reserve(file, 10) != NULL || errno != ENOSPC) result = -1;
+    if (mytell(file) != 10) result = -1;
+    myclose(file);
+    
+    // A flush between reserve and commit cancels the reservation
+    file = myopen("test_reserve.txt", MODE_WT);
+    mysetvbuf(file, MIO_FULLBUF, 64);
+    mywrite(file, "AAAA", 4);
+    p = mywrite_reserve(file, 4);
+    if (p) memcpy(p, "BBBB", 4);
+    myflush(file);
+    int stale = mywrite_commit(file, 4);
+    int err = errno;
+    myclose(file);
+    file = myopen("test_reserve.txt", MODE_R);
+    n = myread64(file, got, sizeof(got));
+    myclose(file);
+    printf("Stale commit: %d, file %.*s (should be -1, AAAA)\n", stale, n > 0 ? (int)n : 0, got);
+    if (!p || stale != -1 || err != EINVAL || n != 4 || memcmp(got, "AAAA", 4) != 0) result = -1;
+    
+    print_test_result("Reserve and Commit", result);
+    return result;
+}
+
+int test_lookahead() {
+    printf("\nTesting Peek, Unget and Skip\n");
+    
+    int result = 0;
+    char content[5000];
+    for (int i = 0; i < (int)sizeof(content) - 1; i++) {
+        content[i] = (char)('a' + i % 26);
+    }
+    content[sizeof(content) - 1] = '\0';
+    create_test_file("test_peek.txt", content);
+    
+    // Peeking across refills does not consume; unget works at the start of rb
+    MIO *file = myopen("test_peek.txt", MODE_R);
+    if (!file) {
+        printf("Failed to open test file\n");
+        return -1;
+    }
+    const char *p;
+    char c;
+    ssize_t n = mypeek(file, 100, &p);
+    if (n != 100 || memcmp(p, content, 100) != 0 || mytell(file) != 0) result = -1;
+    if (myread(file, &c, 1) != 1 || c != 'a' || myungetc(file, 'X') < 0) result = -1;
+    n = mypeek(file, 3, &p);
+    if (n != 3 || memcmp(p, "Xbc", 3) != 0) result = -1;
+    if (myskip(file, 3) != 3 || myungetc(file, 'c') < 0 || myungetc(file, 'b') < 0) result = -1;
+    char buf[8] = {0};
+    if (myread(file, buf, 4) != 4 || memcmp(buf, "bcde", 4) != 0) result = -1;
+    
+    // Skips jump through the file and stop at its end
+    ssize_t skipped = myskip(file, 4000);
+    myread(file, &c, 1);
+    printf("Skipped %zd to '%c' at %lld (should be 4000, '%c', 4006)\n",
+           skipped, c, (long long)mytell(file), content[4005]);
+    if (skipped != 4000 || c != content[4005] || mytell(file) != 4006) result = -1;
+    n = mypeek(file, 10000, &p);
+    skipped = myskip(file, 10000);
+    if (n != 4999 - 4006 || skipped != n || myread(file, &c, 1) > 0) result = -1;
+    myclose(file);
+    
+    // Pipes cannot seek, so skips read through
+    int fds[2];
+    if (pipe(fds) < 0 || write(fds[1], content, 3000) != 3000) {
+        printf("Failed to set up pipe\n");
+        return -1;
+    }
+    close(fds[1]);
+    file = myfdopen(fds[0], MODE_R);
+    skipped = myskip(file, 2500);
+    n = mypeek(file, 1000, &p);
+    printf("Pipe: skipped %zd, %zd left starting '%c' (should be 2500, 500, '%c')\n",
+           skipped, n, n > 0 ? p[0] : '?', content[2500]);
+    if (skipped != 2500 || n != 500 || p[0] != content[2500]) result = -1;
+    myclose(file);
+    
+    // Non-blocking skips return what has arrived, then MIO_WOULDBLOCK
+    if (pipe(fds) < 0 || write(fds[1], content, 100) != 100) {
+        printf("Failed to set up pipe\n");
+        return -1;
+    }
+    file = myfdopen(fds[0], MODE_R);
+    mysetnonblock(file, 1);
+    ssize_t s1 = myskip(file, 300);
+    ssize_t s2 = myskip(file, 300);
+    printf("Non-blocking: skipped %zd then %zd (should be 100 then %d)\n", s1, s2, MIO_WOULDBLOCK);
+    if (s1 != 100 || s2 != MIO_WOULDBLOCK) result = -1;
+    close(fds[1]);
+    myclose(file);
+    
+    print_test_result("Peek, Unget and Skip", result);
+    return result;
+}
+
+int test_token_batch() {
+    printf("\nTesting Batched Tokens\n");
+    
+    int result = 0;
+    // Tokens of every length, a long one that spans many refills, and all
+    // the whitespace kinds mygets() knows
+    static char content[60000];
+    size_t at = 0;
+    int ntok = 0;
+    for (int i = 0; at < 40000; i++, ntok++) {
+        for (int k = 0; k <= i % 23; k++) content[at++] = (char)('a' + (i + k) % 26);
+        content[at++] = " \t\n\r"[i % 4];
+        if (i % 5 == 0) content[at++] = ' ';
+    }
+    memset(content + at, 'L', 15000);
+    at += 15000;
+    ntok++;
+    content[at] = '\0';
+    create_test_file("test_tokens.txt", content);
+    
+    MIO *file = myopen("test_tokens.txt", MODE_R);
+    if (!file) {
+        printf("Failed to open test file\n");
+        return -1;
+    }
+    static char mem[1 << 14];
+    struct mio_arena arena = { mem, sizeof(mem), 0 };
+    struct mio_token tok[64];
+    int count = 0, calls = 0, bad = 0, ws = 0;
+    size_t src = 0;
+    ssize_t n;
+    // An empty batch would look like end of file
+    errno = 0;
+    if (mygets_batch(file, tok, 0, &arena) != -1 || errno != EINVAL) result = -1;
+    for (;;) {
+        arena.used = 0;
+        n = mygets_batch(file, tok, 64, &arena);
+        if (n < 0 && errno == ENOBUFS && arena.size == sizeof(mem)) {
+            // the long token needs a bigger arena
+            static char big[1 << 15];
+            arena = (struct mio_arena){ big, sizeof(big), 0 };
+            n = mygets_batch(file, tok, 64, &arena);
+        }
+        if (n <= 0) break;
+        calls++;
+        for (ssize_t i = 0; i < n; i++, count++) {
+            while (src < at && M_ISWS(content[src])) src++;
+            bad += tok[i].len == 0 || strncmp(tok[i].ptr, content + src, tok[i].len) != 0 ||
+                   tok[i].ptr[tok[i].len] != '\0';
+            src += tok[i].len;
+            ws += src < at && !M_ISWS(content[src]);
+        }
+    }
+    myclose(file);
+    printf("%d tokens in %d calls, %d mismatches, %d split (should be %d, fewer, 0, 0)\n",
+           count, calls, bad, ws, ntok);
+    if (n != 0 || count != ntok || calls >= count || bad != 0 || ws != 0) result = -1;
+    
+    print_test_result("Batched Tokens", result);
+    return result;
+}
+
+// Field j of row i of the generated CSV (quoting decided by the writer)
+static int csv_field(int i, int j, char *out) {
+    switch ((i + j) % 6) {
+        case 0: return sprintf(out, "%d", i * 7 + j);
+        case 1: return sprintf(out, "plain text %d", i);
+        case 2: return sprintf(out, "with, comma %d", j);
+        case 3: return sprintf(out, "say \"hi\"\nand %d", i);
+        case 4: return 0;
+        default: {
+            int n = 40 + i % 90;
+            memset(out, 'x', (size_t)n);
+            return n;
+        }
+    }
+}
+
+int test_csv_reader() {
+    printf("\nTesting CSV Reader\n");
+    
+    int result = 0;
+    MIO *file = myopen("test_csv.txt", MODE_WT);
+    if (!file) {
+        printf("Failed to open test file for writing\n");
+        return -1;
+    }
+    char field[256];
+    int rows = 3000, cols = 7;
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            int n = csv_field(i, j, field);
+            if (j > 0) myputc(file, ',');
+            if (memchr(field, ',', (size_t)n) || memchr(field, '"', (size_t)n) || memchr(field, '\n', (size_t)n)) {
+                myputc(file, '"');
+                for (int k = 0; k < n; k++) {
+                    if (field[k] == '"') myputc(file, '"');
+                    myputc(file, field[k]);
+                }
+                myputc(file, '"');
+            } else {
+                mywrite(file, field, n);
+            }
+        }
+        if (i % 2) myputc(file, '\r');
+        if (i < rows - 1) myputc(file, '\n');  // no newline after the last row
+    }
+    myclose(file);
+    
+    // Every field comes back, quoted ones unescaped
+    file = myopen("test_csv.txt", MODE_R);
+    struct mio_csv *csv = mycsv_open(file, ',');
+    const struct mio_field *f;
+    ssize_t n;
+    int got = 0, bad = 0;
+    while ((n = mycsv_row(csv, &f)) > 0) {
+        bad += n != cols;
+        for (int j = 0; j < n && j < cols; j++) {
+            int len = csv_field(got, j, field);
+            bad += f[j].len != (size_t)len || memcmp(f[j].ptr, field, (size_t)len) != 0;
+        }
+        got++;
+    }
+    printf("All columns: %d rows, %d mismatches, end %zd (should be %d, 0, 0)\n", got, bad, n, rows);
+    if (got != rows || bad != 0 || n != 0) result = -1;
+    
+    // Projection returns the chosen columns in the chosen order
+    myseek(file, 0, SEEK_SET);
+    int pick[] = { 3, 0, 9 };
+    mycsv_project(csv, pick, 3);
+    got = bad = 0;
+    while ((n = mycsv_row(csv, &f)) > 0) {
+        int len3 = csv_field(got, 3, field);
+        bad += n != 3 || f[0].len != (size_t)len3 || memcmp(f[0].ptr, field, (size_t)len3) != 0;
+        int len0 = csv_field(got, 0, field);
+        bad += f[1].len != (size_t)len0 || memcmp(f[1].ptr, field, (size_t)len0) != 0;
+        bad += f[2].ptr != NULL;
+        got++;
+    }
+    printf("Projected: %d rows, %d mismatches (should be %d, 0)\n", got, bad, rows);
+    if (got != rows || bad != 0) result = -1;
+    mycsv_close(csv);
+    myclose(file);
+    
+    // TSV, and a quote left open at the end of the file
+    create_test_file("test_csv.txt", "a\tb b\t\nc,d\t\"e\tf\"\n\"open\tquote\n");
+    file = myopen("test_csv.txt", MODE_R);
+    csv = mycsv_open(file, '\t');
+    ssize_t n1 = mycsv_row(csv, &f);
+    int ok1 = n1 == 3 && f[1].len == 3 && memcmp(f[1].ptr, "b b", 3) == 0 && f[2].len == 0;
+    ssize_t n2 = mycsv_row(csv, &f);
+    int ok2 = n2 == 2 && f[1].len == 3 && memcmp(f[1].ptr, "e\tf", 3) == 0;
+    ssize_t n3 = mycsv_row(csv, &f);
+    int err = errno;
+    printf("TSV rows: %zd %zd %zd (should be 3 2 -1)\n", n1, n2, n3);
+    if (!ok1 || !ok2 || n3 != -1 || err != EBADMSG) result = -1;
+    mycsv_close(csv);
+    myclose(file);
+    
+    print_test_result("CSV Reader", result);
+    return result;
+}
+
+// Text of the numeric columns of row i for the loader test
+static int load_row(int i, char *out) {
+    if (i == 1000) return sprintf(out, "abc,x,%d,1.5\n", i);
+    if (i == 2000) return sprintf(out, "3000000000,x,%d,1.5\n", i);
+    return sprintf(out, "%d,skip me,%lld,%.17g%s\n", i - 150000, (long long)i * 1000000007LL,
+                   i % 5 ? i / 7.0 : i * 0.25, i % 3 ? "" : ",extra");
+}
+
+int test_column_loader() {
+    printf("\nTesting Columnar Numeric Loader\n");
+    
+    int result = 0;
+    MIO *file = myopen("test_load.txt", MODE_WT);
+    if (!file) {
+        printf("Failed to open test file for writing\n");
+        return -1;
+    }
+    char line[128];
+    int rows = 300000;  // about 12 MB, several chunks
+    for (int i = 0; i < rows; i++) {
+        mywrite(file, line, load_row(i, line));
+    }
+    myclose(file);
+    
+    int32_t *a = malloc(rows * sizeof(*a));
+    int64_t *b = malloc(rows * sizeof(*b));
+    double *c = malloc(rows * sizeof(*c));
+    struct mio_column cols[] = {
+        { MIO_COL_I32, a }, { MIO_COL_SKIP, NULL }, { MIO_COL_I64, b }, { MIO_COL_F64, c }
+    };
+    
+    // The first rows alone, then the rest on 4 threads into the same arrays
+    file = myopen("test_load.txt", MODE_R);
+    struct mio_load_stats st1, st2;
+    ssize_t n1 = myload_columns(file, ',', cols, 4, 1500, 1, &st1);
+    struct mio_column rest[] = {
+        { MIO_COL_I32, a + n1 }, { MIO_COL_SKIP, NULL }, { MIO_COL_I64, b + n1 }, { MIO_COL_F64, c + n1 }
+    };
+    ssize_t n2 = myload_columns(file, ',', rest, 4, rows, 4, &st2);
+    myclose(file);
+    printf("Loaded %zd + %zd rows (should be 1500 + %d)\n", n1, n2, rows - 1500);
+    printf("Errors %zu at %zu:%d, then %zu at %zu:%d (should be 1 at 1000:0, 1 at 500:0)\n",
+           st1.errors, st1.first_row, st1.first_col, st2.errors, st2.first_row, st2.first_col);
+    if (n1 != 1500 || n2 != rows - 1500) result = -1;
+    if (st1.errors != 1 || st1.first_row != 1000 || st1.first_col != 0) result = -1;
+    if (st2.errors != 1 || st2.first_row != 500 || st2.first_col != 0) result = -1;
+    
+    int bad = 0;
+    for (int i = 0; i < rows && result == 0; i++) {
+        double want = i % 5 ? i / 7.0 : i * 0.25;
+        if (i == 1000 || i == 2000) {
+            bad += a[i] != 0 || b[i] != i || c[i] != 1.5;
+        } else {
+            bad += a[i] != i - 150000 || b[i] != (int64_t)i * 1000000007LL || c[i] != want;
+        }
+    }
+    printf("Value mismatches: %d (should be 0)\n", bad);
+    if (bad != 0) result = -1;
+    
+    // Missing and malformed fields, no newline at the end
+    create_test_file("test_load.txt", "1;2.5e3;0x10\n-7; ;nan\n\n42;1e400;9\n8");
+    file = myopen("test_load.txt", MODE_R);
+    struct mio_column three[] = { { MIO_COL_I64, b }, { MIO_COL_F64, c }, { MIO_COL_F64, c + 8 } };
+    ssize_t n = myload_columns(file, ';', three, 3, 16, 2, &st1);
+    myclose(file);
+    printf("Short file: %zd rows, %zu errors (should be 5, 7)\n", n, st1.errors);
+    if (n != 5 || st1.errors != 7 || b[0] != 1 || c[0] != 2500.0 || c[8] != 16.0 ||
+        b[1] != -7 || !isnan(c[1]) || !isnan(c[9]) || b[3] != 42 || b[4] != 8) result = -1;
+    
+    // Non-blocking pipes load the complete lines, keep the unfinished one
+    int fds[2];
+    if (pipe(fds) < 0 || write(fds[1], "1,2\n3,4\n5,", 10) != 10) {
+        printf("Failed to set up pipe\n");
+        return -1;
+    }
+    file = myfdopen(fds[0], MODE_R);
+    mysetnonblock(file, 1);
+    struct mio_column two[] = { { MIO_COL_I64, b }, { MIO_COL_I64, b + 8 } };
+    ssize_t p1 = myload_columns(file, ',', two, 2, 16, 1, &st1);
+    ssize_t p2 = myload_columns(file, ',', two, 2, 16, 1, &st1);
+    int pipe_ok = p1 == 2 && b[0] == 1 && b[9] == 4;
+    if (write(fds[1], "6\n", 2) != 2) result = -1;
+    close(fds[1]);
+    ssize_t p3 = myload_columns(file, ',', two, 2, 16, 1, &st1);
+    ssize_t p4 = myload_columns(file, ',', two, 2, 16, 1, &st1);
+    myclose(file);
+    printf("Non-blocking: %zd, %zd, %zd, %zd rows (should be 2, %d, 1, 0)\n", p1, p2, p3, p4, MIO_WOULDBLOCK);
+    if (!pipe_ok || p2 != MIO_WOULDBLOCK || p3 != 1 || p4 != 0 || b[0] != 5 || b[8] != 6 ||
+        st1.errors != 0) result = -1;
+    
+    free(a);
+    free(b);
+    free(c);
+    print_test_result("Columnar Numeric Loader", result);
+    return result;
+}
+
+int test_typed_binary() {
+    printf("\nTesting Typed Binary I/O\n");
+    
+    int result = 0;
+    MIO *file = myopen("test_binary.txt", MODE_WT);
+    if (!file) {
+        printf("Failed to open test file for writing\n");
+        return -1;
+    }
+    enum { N = 100003 };  // not a multiple of the vector width
+    static uint16_t h[N], h2[N];
+    static uint32_t w[N], w2[N];
+    static uint64_t q[N], q2[N];
+    for (int i = 0; i < N; i++) {
+        h[i] = (uint16_t)(i * 40503u);
+        w[i] = (uint32_t)i * 2654435761u;
+        q[i] = (uint64_t)i * 0x9E3779B97F4A7C15ULL;
+    }
+    int rc = mywrite_u32be(file, 0x01020304) | mywrite_u16le(file, 0xBEEF) |
+             mywrite_u64be(file, 0x1122334455667788ULL) | mywrite_u64le(file, 42);
+    ssize_t n1 = mywrite_u32_array(file, w, N, MIO_BE);
+    ssize_t n2 = mywrite_u64_array(file, q, N, MIO_LE);
+    ssize_t n3 = mywrite_u16_array(file, h, N, MIO_BE);
+    mywrite(file, "xyz", 3);
+    myclose(file);
+    printf("Wrote %zd %zd %zd values (should be %d each)\n", n1, n2, n3, N);
+    if (rc != 0 || n1 != N || n2 != N || n3 != N) result = -1;
+    
+    // Big-endian means most significant byte first on disk
+    FILE *fp = fopen("test_binary.txt", "rb");
+    unsigned char head[30], first[4];
+    size_t got = fp ? fread(head, 1, sizeof(head), fp) : 0;
+    if (fp) fclose(fp);
+    first[0] = (unsigned char)(w[1] >> 24);
+    first[1] = (unsigned char)(w[1] >> 16);
+    first[2] = (unsigned char)(w[1] >> 8);
+    first[3] = (unsigned char)w[1];
+    if (got != sizeof(head) || memcmp(head, "\x01\x02\x03\x04\xEF\xBE\x11\x22", 8) != 0 ||
+        head[14] != 42 || memcmp(head + 26, first, 4) != 0) result = -1;
+    
+    file = myopen("test_binary.txt", MODE_R);
+    uint32_t v32 = 0;
+    uint16_t v16 = 0;
+    uint64_t a64 = 0, b64 = 0;
+    rc = myread_u32be(file, &v32) | myread_u16le(file, &v16) |
+         myread_u64be(file, &a64) | myread_u64le(file, &b64);
+    if (rc != 0 || v32 != 0x01020304 || v16 != 0xBEEF || a64 != 0x1122334455667788ULL || b64 != 42) {
+        printf("Single values mismatch\n");
+        result = -1;
+    }
+    n1 = myread_u32_array(file, w2, N, MIO_BE);
+    n2 = myread_u64_array(file, q2, N, MIO_LE);
+    n3 = myread_u16_array(file, h2, N, MIO_BE);
+    int bad = memcmp(w, w2, sizeof(w)) != 0 || memcmp(q, q2, sizeof(q)) != 0 || memcmp(h, h2, sizeof(h)) != 0;
+    printf("Read %zd %zd %zd values, %s\n", n1, n2, n3, bad ? "mismatch" : "all equal");
+    if (n1 != N || n2 != N || n3 != N || bad) result = -1;
+    
+    // Three bytes left: no 32-bit value, and they stay readable
+    char tail[4] = { 0 };
+    ssize_t short_read = myread_u32_array(file, w2, 4, MIO_LE);
+    int tail_ok = myread(file, tail, 3) == 3 && memcmp(tail, "xyz", 3) == 0;
+    printf("Partial value: %zd, tail %s (should be -1, xyz)\n", short_read, tail);
+    if (short_read != -1 || !tail_ok || myread_u16be(file, &v16) != -1) result = -1;
+    myclose(file);
+    
+    // Straight from a memory region, swapping in place of a copy
+    unsigned char be[] = { 0, 0, 0, 1, 0xFF, 0, 0, 2, 0x80, 0, 0, 0 };
+    MIO *mem = mymemopen(be, sizeof(be), MODE_R);
+    n1 = myread_u32_array(mem, w2, 8, MIO_BE);
+    printf("Memory: %zd values %x %x %x (should be 3 1 ff000002 80000000)\n", n1, w2[0], w2[1], w2[2]);
+    if (n1 != 3 || w2[0] != 1 || w2[1] != 0xFF000002u || w2[2] != 0x80000000u) result = -1;
+    myclose(mem);
+    
+    // A direct writer with less than one value free drains before converting
+    file = myopen("test_binary.txt", MODE_WT | MODE_DIRECT);
+    static uint64_t many[262144];
+    for (int i = 0; i < 262144; i++) many[i] = (uint64_t)i << 20 | 7;
+    static char fill[1 << 21];
+    size_t lead = file->wsize - 3 < sizeof(fill) ? file->wsize - 3 : sizeof(fill);
+    memset(fill, 'f', lead);
+    mywrite64(file, fill, lead);
+    ssize_t nd = mywrite_u64_array(file, many, 262144, MIO_BE);
+    myclose(file);
+    file = myopen("test_binary.txt", MODE_R);
+    myread64(file, fill, lead);
+    static uint64_t back[262144];
+    ssize_t nb = myread_u64_array(file, back, 262144, MIO_BE);
+    myclose(file);
+    printf("Direct: wrote %zd, read %zd values (should be 262144 each)\n", nd, nb);
+    if (nd != 262144 || nb != 262144 || memcmp(many, back, sizeof(many)) != 0) result = -1;
+    
+    print_test_result("Typed Binary I/O", result);
+    return result;
+}
+
 int main() {
     printf("MIO Library Comprehensive Test Suite\n");    
     int all_passed = 0;    
@@ -297,6 +2126,30 @@ int main() {
     all_passed |= test_myputs();
     all_passed |= test_append_mode();
     all_passed |= test_error_conditions();
+    all_passed |= test_handle_pool();
+    all_passed |= test_direct_io();
+    all_passed |= test_memory_stream();
+    all_passed |= test_memstream();
+    all_passed |= test_fdopen_pipe();
+    all_passed |= test_nonblocking();
+    all_passed |= test_readv_writev();
+    all_passed |= test_buffering_policies();
+    all_passed |= test_ring_buffer();
+    all_passed |= test_large_file();
+    all_passed |= test_tail_follow();
+    all_passed |= test_reverse_lines();
+    all_passed |= test_block_cache();
+    all_passed |= test_digests();
+    all_passed |= test_filters();
+    all_passed |= test_parallel_compression();
+    all_passed |= test_indexed_container();
+    all_passed |= test_records();
+    all_passed |= test_reserve_commit();
+    all_passed |= test_lookahead();
+    all_passed |= test_token_batch();
+    all_passed |= test_csv_reader();
+    all_passed |= test_column_loader();
+    all_passed |= test_typed_binary();
     if (all_passed == 0) {
         printf("All tests PASSED!\n");
     } else {
@@ -310,6 +2163,25 @@ int main() {
     unlink("test_output.txt");
     unlink("test_strings_out.txt");
     unlink("test_errors.txt");
+    unlink("test_pool.txt");
+    unlink("test_direct.txt");
+    unlink("test_vector.txt");
+    unlink("test_policy.txt");
+    unlink("test_large.txt");
+    unlink("test_follow.txt");
+    unlink("test_reverse.txt");
+    unlink("test_cache.txt");
+    unlink("test_digest.txt");
+    unlink("test_filter.txt");
+    unlink("test_parallel.txt");
+    unlink("test_indexed.txt");
+    unlink("test_records.txt");
+    unlink("test_reserve.txt");
+    unlink("test_peek.txt");
+    unlink("test_tokens.txt");
+    unlink("test_csv.txt");
+    unlink("test_load.txt");
+    unlink("test_binary.txt");
     
     return all_passed;
 }
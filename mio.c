@@ -4,336 +4,4570 @@ File: mio.c
 Default buffer size: 10 bytes (MBSIZE)
 Description: Custom standard I/O library implementation using low-level POSIX I/O functions
 Features: Buffered I/O, multiple file modes (read, write/append, write/truncate), 
-          string and character I/O operations, dynamic buffer management
+          string and character I/O operations, dynamic buffer management,
+          per-thread pooling of handle blocks, O_DIRECT mode with aligned buffers,
+          in-memory streams over caller buffers, growable memory output streams,
+          buffering of pipes, sockets and other existing descriptors,
+          non-blocking mode for event loops, scatter/gather reads and writes,
+          full, line, unbuffered and latency-bounded buffering policies,
+          ring write buffer flushed with writev, 64-bit sizes and offsets
+          for large files and transfers, tail-follow mode for growing files,
+          reverse line reading from the end of a file, process-wide block
+          cache shared by read handles, streaming CRC32C and XXH64 digests,
+          filter stack with an LZ4-format block codec and CRC32C frames,
+          parallel frame compression, block-indexed seekable containers,
+          length-prefixed records, in-place reserve/commit writes,
+          peek/unget/skip lookahead, batched tokenizing into an arena,
+          SIMD CSV/TSV parsing with column projection, columnar numeric
+          loading with SWAR digit parsing on worker threads, typed binary
+          I/O with SSSE3 byte swapping
 Author: Subhajit Halder
 */
 
+#define _GNU_SOURCE
 #include "mio.h"
 #include "dprint.h"
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#include <tmmintrin.h>
+#endif
+
+// 64-bit platforms open large files by default
+#ifndef O_LARGEFILE
+#define O_LARGEFILE 0
+#endif
+
+_Static_assert(sizeof(off_t) == 8, "MIO needs a 64-bit off_t");
+
+// Per-thread cache of released handle blocks, keyed by buffer size
+struct mio_pool_bin {
+    size_t bsize;	// buffer size served by this bin
+    int used;		// bin claimed for bsize (blocks of size 0 exist too)
+    int count;		// blocks on the free list
+    void *head;		// free list, linked through the first word of each block
+};
+static __thread struct mio_pool_bin mio_pool[MIO_POOL_BINS];
+static pthread_key_t mio_pool_key;
+static pthread_once_t mio_pool_once = PTHREAD_ONCE_INIT;
+
+// Filter stack of a handle: the filters in push order, scratch buffers for
+// encoding and decoding frames, and a decoded frame that did not fit the
+// buffer being refilled
+struct mio_fstack {
+    const struct mio_filter *f[MIO_FILTER_MAX];
+    int n;
+    char *fx[2];		// ping-pong scratch, fxcap bytes each
+    size_t fxcap;
+    char *xb;			// decoded bytes xb[xs..xe) still to hand out
+    size_t xcap, xs, xe;
+    struct mio_workers *wk;	// compression workers (MIO_PARALLEL)
+    struct mio_block *blk;	// block index (MIO_INDEXED)
+    size_t nblk, blkcap;
+    size_t blknext;		// reader: block the next frame belongs to
+    off_t woff;			// writer: file offset of the next frame
+    char codec[MIO_FILTER_MAX][16];	// reader: filters the container was written with
+    int ncodec;
+};
+static void mio_workers_free(struct mio_workers *wk);
+
+// Round up to a whole number of cache lines
+#define MIO_CLROUND(X) (((size_t)(X) + MIO_CACHELINE - 1) & ~((size_t)MIO_CACHELINE - 1))
+
+static void mio_pool_destroy(void *unused) {
+    (void)unused;
+    mypool_trim();
+}
+
+static void mio_pool_init(void) {
+    pthread_key_create(&mio_pool_key, mio_pool_destroy);
+}
+
+// Get a handle with both buffers of size bsize in one cache-line aligned block:
+// [struct _mio][rb][wb], each part starting on its own cache line
+static MIO *mio_alloc(size_t bsize) {
+    MIO *mio = NULL;
+    for (int i = 0; i < MIO_POOL_BINS; i++) {
+        if (mio_pool[i].used && mio_pool[i].bsize == bsize && mio_pool[i].head) {
+            mio = mio_pool[i].head;
+            mio_pool[i].head = *(void **)mio;
+            mio_pool[i].count--;
+            break;
+        }
+    }
+    if (!mio) {
+        size_t total = MIO_CLROUND(sizeof(MIO)) + 2 * MIO_CLROUND(bsize);
+        void *block;
+        if (posix_memalign(&block, MIO_CACHELINE, total) != 0) {
+            DPRINT("Failed to allocate handle block of %zu bytes\n", total);
+            return NULL;
+        }
+        mio = block;
+    }
+    memset(mio, 0, sizeof(MIO));
+    mio->fd = -1;
+    mio->flags = MIO_POOLED;
+    mio->psize = bsize;
+    mio->rb = (char *)mio + MIO_CLROUND(sizeof(MIO));
+    mio->wb = mio->rb + MIO_CLROUND(bsize);
+    mio->rsize = bsize;
+    mio->wsize = bsize;
+    return mio;
+}
+
+// Return a handle block to this thread's pool, or free it when the pool is full
+static void mio_release(MIO *m) {
+    free(m->dg);
+    free(m->spill);
+    if (m->fs) {
+        if (m->fs->wk) {
+            mio_workers_free(m->fs->wk);
+        }
+        free(m->fs->fx[0]);
+        free(m->fs->fx[1]);
+        free(m->fs->xb);
+        free(m->fs->blk);
+        free(m->fs);
+    }
+    if (m->flags & MIO_FOLLOW) {
+        close(m->ifd);
+        free(m->path);
+    }
+    if (m->flags & MIO_OWNRB) {
+        free(m->rb);
+    }
+    if (m->flags & MIO_OWNWB) {
+        free(m->wb);
+    }
+    if (!(m->flags & MIO_POOLED)) {
+        free(m);
+        return;
+    }
+    size_t bsize = m->psize;
+    struct mio_pool_bin *bin = NULL;
+    for (int i = 0; i < MIO_POOL_BINS; i++) {
+        if (mio_pool[i].used && mio_pool[i].bsize == bsize) {
+            bin = &mio_pool[i];
+            break;
+        }
+        if (!bin && mio_pool[i].count == 0) {
+            bin = &mio_pool[i];
+        }
+    }
+    if (!bin || bin->count >= MIO_POOL_DEPTH) {
+        free(m);
+        return;
+    }
+    if (!bin->used || bin->bsize != bsize) {
+        // claim an empty bin for this buffer size
+        bin->bsize = bsize;
+        bin->used = 1;
+        pthread_once(&mio_pool_once, mio_pool_init);
+        pthread_setspecific(mio_pool_key, mio_pool);
+    }
+    *(void **)m = bin->head;
+    bin->head = m;
+    bin->count++;
+}
+
+// Free every handle block cached by the calling thread
+void mypool_trim(void) {
+    for (int i = 0; i < MIO_POOL_BINS; i++) {
+        while (mio_pool[i].head) {
+            void *next = *(void **)mio_pool[i].head;
+            free(mio_pool[i].head);
+            mio_pool[i].head = next;
+        }
+        mio_pool[i].count = 0;
+        mio_pool[i].used = 0;
+    }
+}
+
+// Wait until fd is ready for 'events' (POLLIN/POLLOUT)
+static int mio_wait(int fd, short events) {
+    struct pollfd p = { fd, events, 0 };
+    while (poll(&p, 1, -1) < 0) {
+        if (errno != EINTR) {
+            DPRINT("poll failed: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Monotonic clock in microseconds
+static long long mio_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// (Re)arm the inotify watch on the followed file
+static int mio_follow_watch(MIO *m) {
+    if (m->iwd >= 0) {
+        inotify_rm_watch(m->ifd, m->iwd);  // fails harmlessly once the file is gone
+    }
+    m->iwd = inotify_add_watch(m->ifd, m->path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+    return m->iwd;
+}
+
+// Follow mode at end of file: wait until the file grows, is truncated or is
+// replaced by a new file under the same path (log rotation). Returns 0 when
+// the read should be retried, -1 with errno EAGAIN when the wait timed out.
+static int mio_follow(MIO *m) {
+    long long deadline = m->ftimeout > 0 ? mio_now_us() + m->ftimeout * 1000LL : 0;
+    for (;;) {
+        struct stat cur, now;
+        off_t at = lseek(m->fd, 0, SEEK_CUR);
+        if (at < 0 || fstat(m->fd, &cur) < 0) {
+            return -1;
+        }
+        if (cur.st_size > at) {
+            return 0;
+        }
+        if (cur.st_size < at) {
+            // truncated: start over; bytes still buffered sit before offset 0
+            DPRINT("'%s' truncated, reading from the start\n", m->path);
+            lseek(m->fd, 0, SEEK_SET);
+            m->pos = (off_t)m->rs - (off_t)m->re;
+            return 0;
+        }
+        if (stat(m->path, &now) == 0 && (now.st_ino != cur.st_ino || now.st_dev != cur.st_dev)) {
+            // the old file is read to its end, continue with the new one
+            int fd = open(m->path, O_RDONLY | O_LARGEFILE);
+            if (fd >= 0) {
+                DPRINT("'%s' replaced, reopening\n", m->path);
+                close(m->fd);
+                m->fd = fd;
+                m->pos = (off_t)m->rs - (off_t)m->re;
+                mio_follow_watch(m);
+                return 0;
+            }
+        }
+        
+        int wait = (int)m->ftimeout;
+        if (deadline) {
+            long long left = deadline - mio_now_us();
+            wait = left > 0 ? (int)((left + 999) / 1000) : 0;
+        }
+        if (wait == 0 || (m->flags & MIO_NONBLOCK)) {
+            errno = EAGAIN;
+            return -1;
+        }
+        struct pollfd p = { m->ifd, POLLIN, 0 };
+        if (poll(&p, 1, wait) < 0 && errno != EINTR) {
+            DPRINT("poll failed: %s\n", strerror(errno));
+            return -1;
+        }
+        // the events only wake us up; the checks above find out what changed
+        char ev[4096];
+        while (read(m->ifd, ev, sizeof(ev)) > 0) {
+        }
+    }
+}
+
+// read() that retries EINTR and waits out EAGAIN on non-blocking descriptors,
+// unless the handle itself is in non-blocking mode. In follow mode end of file
+// waits for more data instead.
+static ssize_t mio_sysread(MIO *m, char *b, size_t n) {
+    for (;;) {
+        ssize_t got = read(m->fd, b, n);
+        if (got > 0 || (got == 0 && !(m->flags & MIO_FOLLOW))) {
+            return got;
+        }
+        if (got == 0) {
+            if (mio_follow(m) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if ((errno == EAGAIN || errno == EWOULDBLOCK) && !(m->flags & MIO_NONBLOCK) &&
+            mio_wait(m->fd, POLLIN) == 0) {
+            continue;
+        }
+        return -1;
+    }
+}
+
+// writev() counterpart of mio_sysread(); may still be short
+static ssize_t mio_syswritev(MIO *m, const struct iovec *v, int cnt) {
+    for (;;) {
+        ssize_t put = writev(m->fd, v, cnt);
+        if (put >= 0) {
+            return put;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if ((errno == EAGAIN || errno == EWOULDBLOCK) && !(m->flags & MIO_NONBLOCK) &&
+            mio_wait(m->fd, POLLOUT) == 0) {
+            continue;
+        }
+        return -1;
+    }
+}
+
+static ssize_t mio_syswrite(MIO *m, const char *b, size_t n) {
+    struct iovec v = { (void *)b, n };
+    return mio_syswritev(m, &v, 1);
+}
+
+// Skip n bytes at the front of an iovec array
+static void mio_iov_advance(struct iovec **v, int *cnt, size_t n) {
+    while (*cnt > 0 && n >= (*v)->iov_len) {
+        n -= (*v)->iov_len;
+        (*v)++;
+        (*cnt)--;
+    }
+    if (*cnt > 0) {
+        (*v)->iov_base = (char *)(*v)->iov_base + n;
+        (*v)->iov_len -= n;
+    }
+}
+
+// Process-wide block cache: fixed pages keyed by (device, inode, block) and
+// tagged with the file's mtime, in shards each holding its own hash table,
+// page slots, CLOCK hand and lock
+struct mio_cpage {
+    dev_t dev;			// key: file identity and block number
+    ino_t ino;
+    off_t blk;
+    struct timespec mtime;	// version of the file the data was read from
+    size_t len;			// valid bytes (short only at end of file)
+    int ref;			// CLOCK reference bit
+    int state;			// 0 - free, 1 - cached, 2 - being loaded
+    char *data;			// MIO_CACHE_PAGE bytes, allocated on first use
+    struct mio_cpage *next;	// hash chain
+};
+struct mio_cshard {
+    pthread_mutex_t lock;
+    struct mio_cpage *pages;	// page slots
+    struct mio_cpage **table;	// hash buckets (power of two)
+    size_t nbuckets;
+    size_t hand;		// CLOCK hand
+    long hits, misses, evictions;
+};
+static struct mio_cshard mio_cache[MIO_CACHE_SHARDS];
+static size_t mio_cache_npages;	// page slots per shard (0 - cache disabled)
+
+static size_t mio_cache_hash(dev_t dev, ino_t ino, off_t blk) {
+    unsigned long long h = (unsigned long long)dev * 0x9e3779b97f4a7c15ULL;
+    h ^= (unsigned long long)ino * 0xc2b2ae3d27d4eb4fULL;
+    h ^= (unsigned long long)blk * 0x165667b19e3779f9ULL;
+    return (size_t)(h ^ (h >> 29));
+}
+
+// Find a cached page; must hold the shard lock
+static struct mio_cpage **mio_cache_find(struct mio_cshard *sh, MIO *m, off_t blk, size_t h) {
+    struct mio_cpage **pp = &sh->table[(h / MIO_CACHE_SHARDS) & (sh->nbuckets - 1)];
+    while (*pp && !((*pp)->blk == blk && (*pp)->ino == m->ino && (*pp)->dev == m->dev)) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+// Take a page slot for loading: a free one, else the first CLOCK victim
+// without its reference bit; must hold the shard lock
+static struct mio_cpage *mio_cache_victim(struct mio_cshard *sh) {
+    for (size_t scan = 0; scan < 2 * mio_cache_npages; scan++) {
+        struct mio_cpage *p = &sh->pages[sh->hand];
+        sh->hand = (sh->hand + 1) % mio_cache_npages;
+        if (p->state == 2 || (p->state == 1 && p->ref)) {
+            p->ref = 0;
+            continue;
+        }
+        if (p->state == 1) {
+            struct mio_cpage **pp = &sh->table[(mio_cache_hash(p->dev, p->ino, p->blk) / MIO_CACHE_SHARDS) & (sh->nbuckets - 1)];
+            while (*pp != p) {
+                pp = &(*pp)->next;
+            }
+            *pp = p->next;
+            sh->evictions++;
+        }
+        if (!p->data && !(p->data = malloc(MIO_CACHE_PAGE))) {
+            p->state = 0;
+            return NULL;
+        }
+        p->state = 2;
+        return p;
+    }
+    return NULL;  // every page is being loaded
+}
+
+// Copy up to n bytes at file offset 'off' out of one cache page, loading the
+// page with pread() on a miss. Returns the bytes copied, 0 at end of file, -1
+// on error.
+static ssize_t mio_cache_read(MIO *m, char *b, size_t n, off_t off) {
+    off_t blk = off / MIO_CACHE_PAGE;
+    size_t in = (size_t)(off % MIO_CACHE_PAGE);
+    size_t h = mio_cache_hash(m->dev, m->ino, blk);
+    struct mio_cshard *sh = &mio_cache[h % MIO_CACHE_SHARDS];
+    
+    pthread_mutex_lock(&sh->lock);
+    struct mio_cpage **pp = mio_cache_find(sh, m, blk, h);
+    struct mio_cpage *p = *pp;
+    if (p && (p->mtime.tv_sec != m->mtime.tv_sec || p->mtime.tv_nsec != m->mtime.tv_nsec)) {
+        // the file changed since this page was read
+        *pp = p->next;
+        p->state = 0;
+        p = NULL;
+    }
+    if (p) {
+        sh->hits++;
+    } else {
+        sh->misses++;
+        p = mio_cache_victim(sh);
+        pthread_mutex_unlock(&sh->lock);
+        if (!p) {
+            // no slot to load into: read around the cache
+            ssize_t got;
+            while ((got = pread(m->fd, b, n, off)) < 0 && errno == EINTR) {
+            }
+            return got;
+        }
+        
+        // Load without holding the lock so the rest of the shard stays usable
+        size_t len = 0;
+        ssize_t got = 1;
+        while (len < MIO_CACHE_PAGE && got > 0) {
+            got = pread(m->fd, p->data + len, MIO_CACHE_PAGE - len, blk * MIO_CACHE_PAGE + (off_t)len);
+            if (got < 0 && errno == EINTR) {
+                got = 1;
+                continue;
+            }
+            len += got > 0 ? (size_t)got : 0;
+        }
+        
+        pthread_mutex_lock(&sh->lock);
+        if (got < 0) {
+            p->state = 0;
+            pthread_mutex_unlock(&sh->lock);
+            DPRINT("Cache load failed: %s\n", strerror(errno));
+            return -1;
+        }
+        pp = mio_cache_find(sh, m, blk, h);
+        if (*pp) {
+            // another handle loaded the block meanwhile: keep the fresh copy
+            struct mio_cpage *old = *pp;
+            *pp = old->next;
+            old->state = 0;
+        }
+        p->dev = m->dev;
+        p->ino = m->ino;
+        p->blk = blk;
+        p->mtime = m->mtime;
+        p->len = len;
+        p->state = 1;
+        p->next = *pp;
+        *pp = p;
+    }
+    p->ref = 1;
+    size_t copied = 0;
+    if (in < p->len) {
+        copied = p->len - in < n ? p->len - in : n;
+        memcpy(b, p->data + in, copied);
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return (ssize_t)copied;
+}
+
+// Enable the block cache with a memory bound in bytes (at least MIO_CACHE_MIN,
+// one page per shard), or release it with 0. Only handles opened while the cache is enabled use it, and the cache must
+// not be resized or released while such handles are open.
+int mycache_init(size_t bytes) {
+    if (bytes > 0 && bytes < MIO_CACHE_MIN) {
+        DPRINT("Block cache bound below %d bytes\n", MIO_CACHE_MIN);
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < MIO_CACHE_SHARDS && mio_cache_npages; i++) {
+        struct mio_cshard *sh = &mio_cache[i];
+        for (size_t j = 0; sh->pages && j < mio_cache_npages; j++) {
+            free(sh->pages[j].data);
+        }
+        free(sh->pages);
+        free(sh->table);
+        pthread_mutex_destroy(&sh->lock);
+        memset(sh, 0, sizeof(*sh));
+    }
+    mio_cache_npages = 0;
+    if (bytes == 0) {
+        DPRINT("Block cache released\n");
+        return 0;
+    }
+    
+    size_t npages = bytes / MIO_CACHE_PAGE / MIO_CACHE_SHARDS;
+    size_t nbuckets = 1;
+    while (nbuckets < 2 * npages) {
+        nbuckets *= 2;
+    }
+    for (int i = 0; i < MIO_CACHE_SHARDS; i++) {
+        struct mio_cshard *sh = &mio_cache[i];
+        sh->pages = calloc(npages, sizeof(struct mio_cpage));
+        sh->table = calloc(nbuckets, sizeof(struct mio_cpage *));
+        pthread_mutex_init(&sh->lock, NULL);
+        if (!sh->pages || !sh->table) {
+            DPRINT("Failed to allocate block cache\n");
+            mio_cache_npages = npages;
+            mycache_init(0);
+            return -1;
+        }
+        sh->nbuckets = nbuckets;
+    }
+    mio_cache_npages = npages;
+    DPRINT("Block cache of %zu pages of %d bytes\n", npages * MIO_CACHE_SHARDS, MIO_CACHE_PAGE);
+    return 0;
+}
+
+// Totals over all shards
+void mycache_stats(struct mio_cache_stats *st) {
+    memset(st, 0, sizeof(*st));
+    for (int i = 0; i < MIO_CACHE_SHARDS && mio_cache_npages; i++) {
+        struct mio_cshard *sh = &mio_cache[i];
+        pthread_mutex_lock(&sh->lock);
+        st->hits += sh->hits;
+        st->misses += sh->misses;
+        st->evictions += sh->evictions;
+        for (size_t j = 0; j < mio_cache_npages; j++) {
+            st->pages += sh->pages[j].state == 1;
+        }
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+// Per-handle digests, updated as data moves between the buffers and the fd
+struct mio_digest {
+    int which;			// MIO_DIGEST_* selection
+    uint32_t crc;		// CRC32C, kept inverted while running
+    uint64_t v[4];		// XXH64 lanes
+    uint64_t total;		// XXH64 bytes hashed
+    unsigned char mem[32];	// XXH64 partial stripe
+    size_t memsize;
+};
+
+#define MIO_XXH_P1 0x9E3779B185EBCA87ULL
+#define MIO_XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define MIO_XXH_P3 0x165667B19E3779F9ULL
+#define MIO_XXH_P4 0x85EBCA77C2B2AE63ULL
+#define MIO_XXH_P5 0x27D4EB2F165667C5ULL
+
+static uint32_t mio_crc_table[256];
+static uint32_t (*mio_crc_update)(uint32_t crc, const unsigned char *p, size_t n);
+static pthread_once_t mio_crc_once = PTHREAD_ONCE_INIT;
+
+// Table driven CRC32C (Castagnoli, reflected polynomial 0x82F63B78)
+static uint32_t mio_crc_sw(uint32_t crc, const unsigned char *p, size_t n) {
+    while (n--) {
+        crc = mio_crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// SSE4.2 crc32 instruction, eight bytes per step
+__attribute__((target("sse4.2")))
+static uint32_t mio_crc_hw(uint32_t crc, const unsigned char *p, size_t n) {
+#ifdef __x86_64__
+    uint64_t c = crc;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        c = _mm_crc32_u64(c, w);
+    }
+    crc = (uint32_t)c;
+#endif
+    while (n--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+static void mio_crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+        }
+        mio_crc_table[i] = c;
+    }
+    mio_crc_update = mio_crc_sw;
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        mio_crc_update = mio_crc_hw;
+    }
+#endif
+}
+
+static uint64_t mio_rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian loads, as XXH64 defines its input
+static uint64_t mio_le64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static uint32_t mio_le32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static uint64_t mio_xxh_round(uint64_t acc, uint64_t in) {
+    acc += in * MIO_XXH_P2;
+    return mio_rotl64(acc, 31) * MIO_XXH_P1;
+}
+
+static void mio_xxh_reset(struct mio_digest *d) {
+    d->v[0] = MIO_XXH_P1 + MIO_XXH_P2;
+    d->v[1] = MIO_XXH_P2;
+    d->v[2] = 0;
+    d->v[3] = -MIO_XXH_P1;
+    d->total = 0;
+    d->memsize = 0;
+}
+
+// XXH64 (seed 0) over a stream: whole 32-byte stripes go straight into the
+// lanes, the rest waits in mem for the next update
+static void mio_xxh_update(struct mio_digest *d, const unsigned char *p, size_t n) {
+    d->total += n;
+    if (d->memsize + n < 32) {
+        memcpy(d->mem + d->memsize, p, n);
+        d->memsize += n;
+        return;
+    }
+    if (d->memsize) {
+        size_t fill = 32 - d->memsize;
+        memcpy(d->mem + d->memsize, p, fill);
+        for (int i = 0; i < 4; i++) {
+            d->v[i] = mio_xxh_round(d->v[i], mio_le64(d->mem + 8 * i));
+        }
+        p += fill;
+        n -= fill;
+        d->memsize = 0;
+    }
+    for (; n >= 32; p += 32, n -= 32) {
+        d->v[0] = mio_xxh_round(d->v[0], mio_le64(p));
+        d->v[1] = mio_xxh_round(d->v[1], mio_le64(p + 8));
+        d->v[2] = mio_xxh_round(d->v[2], mio_le64(p + 16));
+        d->v[3] = mio_xxh_round(d->v[3], mio_le64(p + 24));
+    }
+    memcpy(d->mem, p, n);
+    d->memsize = n;
+}
+
+static uint64_t mio_xxh_final(const struct mio_digest *d) {
+    uint64_t h;
+    if (d->total >= 32) {
+        h = mio_rotl64(d->v[0], 1) + mio_rotl64(d->v[1], 7) +
+            mio_rotl64(d->v[2], 12) + mio_rotl64(d->v[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h ^= mio_xxh_round(0, d->v[i]);
+            h = h * MIO_XXH_P1 + MIO_XXH_P4;
+        }
+    } else {
+        h = MIO_XXH_P5;
+    }
+    h += d->total;
+    
+    const unsigned char *p = d->mem;
+    size_t n = d->memsize;
+    for (; n >= 8; p += 8, n -= 8) {
+        h ^= mio_xxh_round(0, mio_le64(p));
+        h = mio_rotl64(h, 27) * MIO_XXH_P1 + MIO_XXH_P4;
+    }
+    if (n >= 4) {
+        h ^= (uint64_t)mio_le32(p) * MIO_XXH_P1;
+        h = mio_rotl64(h, 23) * MIO_XXH_P2 + MIO_XXH_P3;
+        p += 4;
+        n -= 4;
+    }
+    while (n--) {
+        h ^= *p++ * MIO_XXH_P5;
+        h = mio_rotl64(h, 11) * MIO_XXH_P1;
+    }
+    h ^= h >> 33;
+    h *= MIO_XXH_P2;
+    h ^= h >> 29;
+    h *= MIO_XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+static void mio_digest_update(struct mio_digest *d, const void *b, size_t n) {
+    if (d->which & MIO_DIGEST_CRC32C) {
+        d->crc = mio_crc_update(d->crc, b, n);
+    }
+    if (d->which & MIO_DIGEST_XXH64) {
+        mio_xxh_update(d, b, n);
+    }
+}
+
+// Feed the first n bytes of an iovec array to the digests
+static void mio_digest_iov(struct mio_digest *d, const struct iovec *v, size_t n) {
+    for (; n > 0; v++) {
+        size_t len = v->iov_len < n ? v->iov_len : n;
+        mio_digest_update(d, v->iov_base, len);
+        n -= len;
+    }
+}
+
+static void mio_put32le(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+// Grow both scratch buffers to at least 'size' bytes
+static int mio_fx_reserve(struct mio_fstack *fs, size_t size) {
+    if (size <= fs->fxcap) {
+        return 0;
+    }
+    for (int i = 0; i < 2; i++) {
+        char *fx = realloc(fs->fx[i], size);
+        if (!fx) {
+            DPRINT("Failed to allocate %zu byte filter buffer\n", size);
+            return -1;
+        }
+        fs->fx[i] = fx;
+    }
+    fs->fxcap = size;
+    return 0;
+}
+
+// Largest intermediate size when encoding 'raw' bytes through the stack
+static size_t mio_filter_bound(struct mio_fstack *fs, size_t raw) {
+    size_t size = raw, most = raw;
+    for (int i = 0; i < fs->n; i++) {
+        size = fs->f[i]->bound(fs->f[i]->ctx, size);
+        most = size > most ? size : most;
+    }
+    return most;
+}
+
+// read() until n bytes arrived or end of file; returns the bytes read or -1
+static ssize_t mio_readfull(MIO *m, void *b, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t got = mio_sysread(m, (char *)b + done, n - done);
+        if (got < 0) {
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        done += (size_t)got;
+    }
+    return (ssize_t)done;
+}
+
+// Decode a frame of enc bytes in fx[0] through the stack (last pushed filter
+// first) into the raw bytes at dst, using fx as scratch of cap bytes each
+static int mio_filter_decode(struct mio_fstack *fs, char *const fx[2], size_t cap,
+                             size_t enc, char *dst, size_t raw) {
+    const char *src = fx[0];
+    size_t len = enc;
+    if (fs->n == 0 && enc <= raw) {
+        memcpy(dst, src, enc);
+    }
+    for (int i = fs->n - 1; i >= 0; i--) {
+        char *out = (i == 0) ? dst : fx[(fs->n - i) % 2];
+        ssize_t dec = fs->f[i]->decode(fs->f[i]->ctx, src, len, out, i == 0 ? raw : cap);
+        if (dec < 0) {
+            DPRINT("Filter '%s' failed to decode a frame\n", fs->f[i]->name);
+            errno = EBADMSG;
+            return -1;
+        }
+        src = out;
+        len = (size_t)dec;
+    }
+    if (len != raw) {
+        DPRINT("Frame decoded to %zu bytes, expected %zu\n", len, raw);
+        errno = EBADMSG;
+        return -1;
+    }
+    return 0;
+}
+
+// Refill for filtered handles: read the next frame {rawlen, enclen, data},
+// decode it through the stack (last pushed filter first) and hand out up to
+// n bytes. Frames that fit are decoded straight into b.
+static ssize_t mio_filter_input(MIO *m, char *b, size_t n) {
+    struct mio_fstack *fs = m->fs;
+    if (fs->n < fs->ncodec) {
+        DPRINT("Container filter '%.16s' was not pushed\n", fs->codec[fs->n]);
+        errno = EINVAL;
+        return -1;
+    }
+    if (fs->xs == fs->xe) {
+        if ((m->flags & MIO_INDEXED) && fs->blknext >= fs->nblk) {
+            return 0;  // the index follows the last block
+        }
+        unsigned char hdr[MIO_FRAME_HDR];
+        ssize_t got = mio_readfull(m, hdr, sizeof(hdr));
+        if (got <= 0) {
+            return got;
+        }
+        size_t raw = mio_le32(hdr), enc = mio_le32(hdr + 4);
+        if (got != MIO_FRAME_HDR || raw > MIO_FILTER_BSIZE ||
+            mio_fx_reserve(fs, mio_filter_bound(fs, raw)) < 0 ||
+            enc > fs->fxcap || mio_readfull(m, fs->fx[0], enc) != (ssize_t)enc) {
+            DPRINT("Truncated or invalid frame\n");
+            errno = EBADMSG;
+            return -1;
+        }
+        
+        char *dst = b;
+        if (raw > n) {
+            if (raw > fs->xcap) {
+                char *xb = realloc(fs->xb, raw);
+                if (!xb) {
+                    DPRINT("Failed to allocate %zu byte frame buffer\n", raw);
+                    return -1;
+                }
+                fs->xb = xb;
+                fs->xcap = raw;
+            }
+            dst = fs->xb;
+        }
+        if (mio_filter_decode(fs, fs->fx, fs->fxcap, enc, dst, raw) < 0) {
+            return -1;
+        }
+        fs->blknext++;
+        if (dst == b) {
+            return (ssize_t)raw;
+        }
+        fs->xs = 0;
+        fs->xe = raw;
+    }
+    size_t copy = fs->xe - fs->xs < n ? fs->xe - fs->xs : n;
+    memcpy(b, fs->xb + fs->xs, copy);
+    fs->xs += copy;
+    return (ssize_t)copy;
+}
+
+// Lines in a block, the record count kept by the block index
+static size_t mio_count_records(const char *b, size_t n) {
+    size_t count = 0;
+    const char *end = b + n;
+    while ((b = memchr(b, '\n', (size_t)(end - b))) != NULL) {
+        count++;
+        b++;
+    }
+    return count;
+}
+
+// Write one frame {rawlen, enclen} + data, continuing after short writes;
+// indexed writers also record the block
+static int mio_frame_write(MIO *m, size_t raw, size_t records, const char *data, size_t len) {
+    unsigned char hdr[MIO_FRAME_HDR];
+    mio_put32le(hdr, (uint32_t)raw);
+    mio_put32le(hdr + 4, (uint32_t)len);
+    struct iovec v[2] = { { hdr, sizeof(hdr) }, { (void *)data, len } };
+    struct iovec *cur = v;
+    int cnt = 2;
+    while (cnt > 0) {
+        ssize_t put = mio_syswritev(m, cur, cnt);
+        if (put < 0) {
+            DPRINT("Write error during filtered flush: %s\n", strerror(errno));
+            return -1;
+        }
+        mio_iov_advance(&cur, &cnt, (size_t)put);
+    }
+    DPRINT("Wrote frame of %zu bytes encoded to %zu\n", raw, len);
+    
+    struct mio_fstack *fs = m->fs;
+    if (m->flags & MIO_INDEXED) {
+        if (fs->nblk == fs->blkcap) {
+            size_t cap = fs->blkcap ? 2 * fs->blkcap : 64;
+            struct mio_block *blk = realloc(fs->blk, cap * sizeof(struct mio_block));
+            if (!blk) {
+                DPRINT("Failed to grow the block index\n");
+                return -1;
+            }
+            fs->blk = blk;
+            fs->blkcap = cap;
+        }
+        struct mio_block *e = &fs->blk[fs->nblk];
+        e->offset = fs->woff;
+        e->rawoff = fs->nblk ? e[-1].rawoff + (off_t)e[-1].rawlen : 0;
+        e->rawlen = raw;
+        e->enclen = len;
+        e->records = records;
+        fs->nblk++;
+        fs->woff += MIO_FRAME_HDR + (off_t)len;
+    }
+    return 0;
+}
+
+// Encode n bytes through the whole stack using the scratch pair fx (cap
+// bytes each); returns the encoded length and where it ended up, or -1
+static ssize_t mio_filter_encode(struct mio_fstack *fs, const char *src, size_t n,
+                                 char *const fx[2], size_t cap, const char **out) {
+    for (int i = 0; i < fs->n; i++) {
+        ssize_t enc = fs->f[i]->encode(fs->f[i]->ctx, src, n, fx[i % 2], cap);
+        if (enc < 0) {
+            DPRINT("Filter '%s' failed to encode a frame\n", fs->f[i]->name);
+            return -1;
+        }
+        src = fx[i % 2];
+        n = (size_t)enc;
+    }
+    *out = src;
+    return (ssize_t)n;
+}
+
+// Flush for filtered handles: encode the pending bytes (contiguous, the head
+// of a filtered ring stays at 0) through the stack and write them as one frame
+static int mio_filter_flush(MIO *m) {
+    struct mio_fstack *fs = m->fs;
+    if (mio_fx_reserve(fs, mio_filter_bound(fs, m->ws)) < 0) {
+        return -1;
+    }
+    const char *out;
+    ssize_t len = mio_filter_encode(fs, m->wb, m->ws, fs->fx, fs->fxcap, &out);
+    size_t records = (m->flags & MIO_INDEXED) ? mio_count_records(m->wb, m->ws) : 0;
+    if (len < 0 || mio_frame_write(m, m->ws, records, out, (size_t)len) < 0) {
+        return -1;
+    }
+    if (m->flags & MIO_DIGEST) {
+        mio_digest_update(m->dg, m->wb, m->ws);  // digests cover the raw stream
+    }
+    
+    int done = (int)m->ws;
+    m->ws = 0;
+    m->wh = 0;
+    m->wsince = 0;
+    m->wres = 0;
+    return done;
+}
+
+// Parallel compression for filtered writers: full buffers are copied into
+// jobs, encoded by a pool of threads, and written in submission order by the
+// thread that owns the handle. Jobs form a ring indexed by sequence number.
+enum { MIO_JOB_FREE, MIO_JOB_QUEUED, MIO_JOB_BUSY, MIO_JOB_DONE, MIO_JOB_FAILED };
+
+struct mio_job {
+    int state;			// MIO_JOB_*
+    char *raw;			// MIO_FILTER_BSIZE bytes
+    size_t rawlen;
+    char *fx[2];		// encoding scratch, fxcap bytes each
+    const char *out;		// encoded frame, in fx[0] or fx[1]
+    size_t outlen;
+    size_t records;		// lines, for indexed writers
+};
+
+struct mio_workers {
+    pthread_mutex_t lock;
+    pthread_cond_t work;	// a job was queued, or stop was set
+    pthread_cond_t done;	// a job finished
+    pthread_t *threads;
+    int nthreads, stop, count;	// count: job records are wanted
+    struct mio_fstack *fs;
+    struct mio_job *jobs;
+    int njobs;
+    size_t fxcap;
+    unsigned long submitted, written;	// sequence numbers
+};
+
+static void *mio_worker_main(void *arg) {
+    struct mio_workers *wk = arg;
+    pthread_mutex_lock(&wk->lock);
+    for (;;) {
+        struct mio_job *job = NULL;
+        for (unsigned long seq = wk->written; seq < wk->submitted; seq++) {
+            if (wk->jobs[seq % wk->njobs].state == MIO_JOB_QUEUED) {
+                job = &wk->jobs[seq % wk->njobs];
+                break;
+            }
+        }
+        if (!job) {
+            if (wk->stop) {
+                break;
+            }
+            pthread_cond_wait(&wk->work, &wk->lock);
+            continue;
+        }
+        job->state = MIO_JOB_BUSY;
+        pthread_mutex_unlock(&wk->lock);
+        
+        ssize_t len = mio_filter_encode(wk->fs, job->raw, job->rawlen, job->fx, wk->fxcap, &job->out);
+        job->outlen = len < 0 ? 0 : (size_t)len;
+        job->records = wk->count ? mio_count_records(job->raw, job->rawlen) : 0;
+        
+        pthread_mutex_lock(&wk->lock);
+        job->state = len < 0 ? MIO_JOB_FAILED : MIO_JOB_DONE;
+        pthread_cond_broadcast(&wk->done);
+    }
+    pthread_mutex_unlock(&wk->lock);
+    return NULL;
+}
+
+// Stop the workers and free the pool; jobs not yet written are dropped
+static void mio_workers_free(struct mio_workers *wk) {
+    pthread_mutex_lock(&wk->lock);
+    wk->stop = 1;
+    pthread_cond_broadcast(&wk->work);
+    pthread_mutex_unlock(&wk->lock);
+    for (int i = 0; i < wk->nthreads; i++) {
+        pthread_join(wk->threads[i], NULL);
+    }
+    for (int i = 0; i < wk->njobs; i++) {
+        free(wk->jobs[i].raw);
+        free(wk->jobs[i].fx[0]);
+        free(wk->jobs[i].fx[1]);
+    }
+    pthread_mutex_destroy(&wk->lock);
+    pthread_cond_destroy(&wk->work);
+    pthread_cond_destroy(&wk->done);
+    free(wk->jobs);
+    free(wk->threads);
+    free(wk);
+}
+
+// Write finished jobs in order, while they are done; with 'upto' set, wait
+// until every job before sequence 'upto' is written
+static int mio_workers_drain(MIO *m, unsigned long upto) {
+    struct mio_workers *wk = m->fs->wk;
+    pthread_mutex_lock(&wk->lock);
+    while (wk->written < wk->submitted) {
+        struct mio_job *job = &wk->jobs[wk->written % wk->njobs];
+        if (job->state == MIO_JOB_FAILED) {
+            pthread_mutex_unlock(&wk->lock);
+            errno = EIO;
+            return -1;
+        }
+        if (job->state != MIO_JOB_DONE) {
+            if (wk->written >= upto) {
+                break;
+            }
+            pthread_cond_wait(&wk->done, &wk->lock);
+            continue;
+        }
+        // only this thread touches done jobs, so write without the lock
+        pthread_mutex_unlock(&wk->lock);
+        int rc = mio_frame_write(m, job->rawlen, job->records, job->out, job->outlen);
+        pthread_mutex_lock(&wk->lock);
+        if (rc < 0) {
+            pthread_mutex_unlock(&wk->lock);
+            return -1;
+        }
+        job->state = MIO_JOB_FREE;
+        wk->written++;
+    }
+    pthread_mutex_unlock(&wk->lock);
+    return 0;
+}
+
+// Hand the pending bytes to the workers; waits only when every job is in use
+static int mio_workers_submit(MIO *m) {
+    struct mio_workers *wk = m->fs->wk;
+    // the slot for the next job must have been written out
+    unsigned long seq = wk->submitted;
+    if (mio_workers_drain(m, seq >= (unsigned long)wk->njobs ? seq - wk->njobs + 1 : 0) < 0) {
+        return -1;
+    }
+    struct mio_job *job = &wk->jobs[seq % wk->njobs];
+    memcpy(job->raw, m->wb, m->ws);
+    job->rawlen = m->ws;
+    if (m->flags & MIO_DIGEST) {
+        mio_digest_update(m->dg, m->wb, m->ws);  // in order, before encoding
+    }
+    
+    pthread_mutex_lock(&wk->lock);
+    job->state = MIO_JOB_QUEUED;
+    wk->submitted++;
+    pthread_cond_signal(&wk->work);
+    pthread_mutex_unlock(&wk->lock);
+    
+    int done = (int)m->ws;
+    m->ws = 0;
+    m->wh = 0;
+    m->wsince = 0;
+    m->wres = 0;
+    return done;
+}
+
+// LZ4 block format: sequences of a token (literal length << 4 | match length
+// - 4), extra length bytes, literals and a 16-bit little-endian offset; the
+// last sequence has literals only. Greedy single-probe hash matching.
+#define MIO_LZ_HASHLOG 12
+#define MIO_LZ_MINMATCH 4
+#define MIO_LZ_LASTLITERALS 5	// the block always ends with this many literals
+#define MIO_LZ_MFLIMIT 12	// no match may start closer to the end
+
+static uint32_t mio_lz_read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static unsigned char *mio_lz_putlen(unsigned char *op, size_t len) {
+    for (; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+static size_t mio_lz_bound(void *ctx, size_t n) {
+    (void)ctx;
+    return n + n / 255 + 16;
+}
+
+static ssize_t mio_lz_encode(void *ctx, const char *src, size_t n, char *dst, size_t cap) {
+    (void)ctx;
+    const unsigned char *base = (const unsigned char *)src;
+    const unsigned char *ip = base, *anchor = base, *end = base + n;
+    unsigned char *op = (unsigned char *)dst, *oend = op + cap;
+    uint32_t table[1 << MIO_LZ_HASHLOG];
+    memset(table, 0, sizeof(table));
+    
+    if (n > MIO_LZ_MFLIMIT) {
+        const unsigned char *mflimit = end - MIO_LZ_MFLIMIT;
+        const unsigned char *matchlimit = end - MIO_LZ_LASTLITERALS;
+        unsigned misses = 0;
+        while (ip < mflimit) {
+            uint32_t seq = mio_lz_read32(ip);
+            uint32_t h = (seq * 2654435761U) >> (32 - MIO_LZ_HASHLOG);
+            const unsigned char *ref = base + table[h];
+            table[h] = (uint32_t)(ip - base);
+            if (ref >= ip || ip - ref > 65535 || mio_lz_read32(ref) != seq) {
+                // step faster through data that does not compress
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const unsigned char *mend = ip + MIO_LZ_MINMATCH, *r = ref + MIO_LZ_MINMATCH;
+            while (mend < matchlimit && *mend == *r) {
+                mend++;
+                r++;
+            }
+            
+            size_t lit = (size_t)(ip - anchor), mlen = (size_t)(mend - ip) - MIO_LZ_MINMATCH;
+            if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1) {
+                return -1;
+            }
+            unsigned char *token = op++;
+            *token = (unsigned char)(((lit >= 15 ? 15 : lit) << 4) | (mlen >= 15 ? 15 : mlen));
+            if (lit >= 15) {
+                op = mio_lz_putlen(op, lit - 15);
+            }
+            memcpy(op, anchor, lit);
+            op += lit;
+            size_t off = (size_t)(ip - ref);
+            *op++ = (unsigned char)off;
+            *op++ = (unsigned char)(off >> 8);
+            if (mlen >= 15) {
+                op = mio_lz_putlen(op, mlen - 15);
+            }
+            ip = anchor = mend;
+        }
+    }
+    
+    size_t lit = (size_t)(end - anchor);
+    if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit) {
+        return -1;
+    }
+    *op++ = (unsigned char)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15) {
+        op = mio_lz_putlen(op, lit - 15);
+    }
+    memcpy(op, anchor, lit);
+    op += lit;
+    return (ssize_t)(op - (unsigned char *)dst);
+}
+
+// Read an LZ4 extra length; returns (size_t)-1 when the input runs out
+static size_t mio_lz_getlen(const unsigned char **ip, const unsigned char *iend) {
+    size_t len = 0;
+    unsigned char b;
+    do {
+        if (*ip >= iend) {
+            return (size_t)-1;
+        }
+        b = *(*ip)++;
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+static ssize_t mio_lz_decode(void *ctx, const char *src, size_t n, char *dst, size_t cap) {
+    (void)ctx;
+    const unsigned char *ip = (const unsigned char *)src, *iend = ip + n;
+    unsigned char *op = (unsigned char *)dst, *oend = op + cap;
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            size_t extra = mio_lz_getlen(&ip, iend);
+            if (extra == (size_t)-1) {
+                return -1;
+            }
+            lit += extra;
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend) {
+            break;  // last sequence
+        }
+        
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t off = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15) {
+            size_t extra = mio_lz_getlen(&ip, iend);
+            if (extra == (size_t)-1) {
+                return -1;
+            }
+            mlen += extra;
+        }
+        mlen += MIO_LZ_MINMATCH;
+        if (off == 0 || off > (size_t)(op - (unsigned char *)dst) || mlen > (size_t)(oend - op)) {
+            return -1;
+        }
+        const unsigned char *r = op - off;
+        if (off >= mlen) {
+            memcpy(op, r, mlen);
+        } else {
+            // overlapping copy repeats the last 'off' bytes
+            for (size_t i = 0; i < mlen; i++) {
+                op[i] = r[i];
+            }
+        }
+        op += mlen;
+    }
+    return (ssize_t)(op - (unsigned char *)dst);
+}
+
+const struct mio_filter mio_filter_lz = {
+    "lz", NULL, mio_lz_bound, mio_lz_encode, mio_lz_decode
+};
+
+// CRC32C filter: appends the block's CRC32C, verifies and strips it on decode
+static size_t mio_crcf_bound(void *ctx, size_t n) {
+    (void)ctx;
+    return n + 4;
+}
+
+static ssize_t mio_crcf_encode(void *ctx, const char *src, size_t n, char *dst, size_t cap) {
+    (void)ctx;
+    if (cap < n + 4) {
+        return -1;
+    }
+    pthread_once(&mio_crc_once, mio_crc_init);
+    memcpy(dst, src, n);
+    mio_put32le((unsigned char *)dst + n, mio_crc_update(0xFFFFFFFF, (const unsigned char *)src, n) ^ 0xFFFFFFFF);
+    return (ssize_t)(n + 4);
+}
+
+static ssize_t mio_crcf_decode(void *ctx, const char *src, size_t n, char *dst, size_t cap) {
+    (void)ctx;
+    if (n < 4 || cap < n - 4) {
+        return -1;
+    }
+    pthread_once(&mio_crc_once, mio_crc_init);
+    uint32_t crc = mio_crc_update(0xFFFFFFFF, (const unsigned char *)src, n - 4) ^ 0xFFFFFFFF;
+    if (crc != mio_le32((const unsigned char *)src + n - 4)) {
+        DPRINT("Frame checksum mismatch\n");
+        return -1;
+    }
+    memcpy(dst, src, n - 4);
+    return (ssize_t)(n - 4);
+}
+
+const struct mio_filter mio_filter_crc = {
+    "crc32c", NULL, mio_crcf_bound, mio_crcf_encode, mio_crcf_decode
+};
+
+// Read the bytes that follow the buffered data: from the block cache for
+// cached handles, else from the descriptor
+static ssize_t mio_input(MIO *m, char *b, size_t n) {
+    if (m->flags & MIO_FILTER) {
+        // digests cover the decoded stream, not the frames
+        ssize_t got = mio_filter_input(m, b, n);
+        if (got > 0 && (m->flags & MIO_DIGEST)) {
+            mio_digest_update(m->dg, b, (size_t)got);
+        }
+        return got;
+    }
+    if (!(m->flags & MIO_CACHED)) {
+        ssize_t got = mio_sysread(m, b, n);
+        if (got > 0 && (m->flags & MIO_DIGEST)) {
+            mio_digest_update(m->dg, b, (size_t)got);
+        }
+        return got;
+    }
+    off_t off = m->pos - (off_t)m->rs + (off_t)m->re;
+    size_t done = 0;
+    while (done < n) {
+        ssize_t got = mio_cache_read(m, b + done, n - done, off + (off_t)done);
+        if (got < 0) {
+            return done > 0 ? (ssize_t)done : -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        done += (size_t)got;
+    }
+    if (done > 0 && (m->flags & MIO_DIGEST)) {
+        mio_digest_update(m->dg, b, done);
+    }
+    return (ssize_t)done;
+}
+
+// The pending bytes of the ring write buffer as one or two segments
+static int mio_wsegs(MIO *m, struct iovec v[2]) {
+    size_t first = m->wsize - m->wh;
+    if (m->ws <= first) {
+        v[0].iov_base = m->wb + m->wh;
+        v[0].iov_len = m->ws;
+        return 1;
+    }
+    v[0].iov_base = m->wb + m->wh;
+    v[0].iov_len = first;
+    v[1].iov_base = m->wb;
+    v[1].iov_len = m->ws - first;
+    return 2;
+}
+
+// Drop n flushed bytes from the head of the ring write buffer
+static void mio_wconsume(MIO *m, size_t n) {
+    m->wres = 0;  // draining wb cancels a reservation
+    m->ws -= n;
+    m->wh = (m->ws == 0) ? 0 : (m->wh + n) % m->wsize;
+    if (m->ws == 0) {
+        m->wsince = 0;  // MIO_TIMEBUF: nothing is waiting any more
+    }
+}
+
+// Move the unread part of rb into a new buffer of 'size' bytes. Direct
+// handles keep the whole aligned block holding the cursor in an aligned buffer.
+static int mio_resize_rb(MIO *m, size_t size) {
+    size_t from = (m->flags & MIO_DIRECT) ? m->rs - m->rs % m->dalign : m->rs;
+    size_t unread = m->re - from;
+    if (size < unread || size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    void *rb = NULL;
+    if ((m->flags & MIO_DIRECT) ? posix_memalign(&rb, m->dalign, size) != 0 : !(rb = malloc(size))) {
+        DPRINT("Failed to allocate %zu byte read buffer\n", size);
+        return -1;
+    }
+    memcpy(rb, m->rb + from, unread);
+    if (m->flags & MIO_OWNRB) {
+        free(m->rb);
+    }
+    m->rb = rb;
+    m->rsize = size;
+    m->rs -= from;
+    m->re = unread;
+    m->flags |= MIO_OWNRB;
+    return 0;
+}
+
+// Move the pending part of wb into a new buffer of 'size' bytes
+static int mio_resize_wb(MIO *m, size_t size) {
+    if (size < m->ws || size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    char *wb = malloc(size);
+    if (!wb) {
+        DPRINT("Failed to allocate %zu byte write buffer\n", size);
+        return -1;
+    }
+    // unwrap the ring into the front of the new buffer
+    struct iovec v[2];
+    int cnt = m->ws > 0 ? mio_wsegs(m, v) : 0;
+    size_t at = 0;
+    for (int i = 0; i < cnt; at += v[i].iov_len, i++) {
+        memcpy(wb + at, v[i].iov_base, v[i].iov_len);
+    }
+    m->wh = 0;
+    m->wres = 0;
+    if (m->flags & MIO_OWNWB) {
+        free(m->wb);
+    }
+    m->wb = wb;
+    m->wsize = size;
+    m->flags |= MIO_OWNWB;
+    return 0;
+}
+
+// Alignment required for O_DIRECT transfers on fd: the larger of the
+// memory and offset alignments reported by statx(), else MIO_DIRECT_ALIGN
+static size_t mio_dio_align(int fd) {
+    size_t align = MIO_DIRECT_ALIGN;
+#ifdef STATX_DIOALIGN
+    struct statx sx;
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &sx) == 0 &&
+        (sx.stx_mask & STATX_DIOALIGN) && sx.stx_dio_offset_align > 0) {
+        align = sx.stx_dio_offset_align;
+        if (sx.stx_dio_mem_align > align) {
+            align = sx.stx_dio_mem_align;
+        }
+    }
+#endif
+    return align;
+}
+
+// Replace the pooled buffers with block-aligned ones for O_DIRECT. In append
+// mode the unaligned tail of the file is loaded into wb and the file offset
+// moved back to the last aligned boundary, so every write stays aligned.
+static int mio_setup_direct(MIO *m) {
+    size_t align = mio_dio_align(m->fd);
+    size_t bsize = ((MIO_DIRECT_BSIZE + align - 1) / align) * align;
+    void *rb = NULL, *wb = NULL;
+    if (posix_memalign(&rb, align, bsize) != 0 || posix_memalign(&wb, align, bsize) != 0) {
+        DPRINT("Failed to allocate aligned buffers\n");
+        free(rb);
+        return -1;
+    }
+    m->rb = rb;
+    m->wb = wb;
+    m->rsize = bsize;
+    m->wsize = bsize;
+    m->dalign = align;
+    m->flags |= MIO_DIRECT | MIO_OWNRB | MIO_OWNWB;
+    
+    if (m->rw == MODE_WA) {
+        off_t size = lseek(m->fd, 0, SEEK_END);
+        if (size < 0) {
+            DPRINT("Failed to seek to end of file: %s\n", strerror(errno));
+            return -1;
+        }
+        off_t base = size - size % (off_t)align;
+        size_t tail = (size_t)(size - base);
+        if (tail > 0 && pread(m->fd, m->wb, align, base) != (ssize_t)tail) {
+            DPRINT("Failed to load unaligned file tail: %s\n", strerror(errno));
+            return -1;
+        }
+        if (lseek(m->fd, base, SEEK_SET) < 0) {
+            return -1;
+        }
+        m->ws = tail;
+        m->pos = size;
+    }
+    DPRINT("Direct I/O with %zu byte alignment, %zu byte buffers\n", align, bsize);
+    return 0;
+}
+
+// Write the whole aligned blocks of wb with O_DIRECT and keep the unaligned
+// remainder at the front of wb. With 'tail' set the remainder is also written,
+// zero padded to a full block, after which the file is truncated back to its
+// logical size and the offset rewound so the next flush rewrites that block.
+// Direct handles always flush from the front, so their ring head stays at 0.
+static ssize_t mio_flush_direct(MIO *m, int tail) {
+    size_t aligned = m->ws - m->ws % m->dalign;
+    size_t done = 0;
+    while (done < aligned) {
+        ssize_t written = mio_syswrite(m, m->wb + done, aligned - done);
+        if (written < 0) {
+            DPRINT("Direct write error during flush: %s\n", strerror(errno));
+            return -1;
+        }
+        done += (size_t)written;
+    }
+    size_t rest = m->ws - aligned;
+    if (rest > 0 && aligned > 0) {
+        memmove(m->wb, m->wb + aligned, rest);
+    }
+    m->ws = rest;
+    m->wres = 0;
+    
+    if (tail && rest > 0) {
+        off_t pos = lseek(m->fd, 0, SEEK_CUR);
+        if (pos < 0) {
+            return -1;
+        }
+        memset(m->wb + rest, 0, m->dalign - rest);
+        if (mio_syswrite(m, m->wb, m->dalign) != (ssize_t)m->dalign ||
+            ftruncate(m->fd, pos + (off_t)rest) < 0 ||
+            lseek(m->fd, pos, SEEK_SET) < 0) {
+            DPRINT("Failed to write unaligned tail: %s\n", strerror(errno));
+            return -1;
+        }
+        done += rest;
+    }
+    DPRINT("Direct flush wrote %zu bytes, %zu kept buffered\n", done, m->ws);
+    return (ssize_t)done;
+}
+
+// Keep what follow mode needs to find the file again: its path and inotify
+// watches on the file and on its directory, where a replacement shows up
+static int mio_setup_follow(MIO *m, const char *name) {
+    m->flags |= MIO_FOLLOW;
+    m->path = strdup(name);
+    m->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    m->iwd = -1;
+    m->ftimeout = -1;
+    if (!m->path || m->ifd < 0 || mio_follow_watch(m) < 0) {
+        DPRINT("Failed to set up inotify for '%s': %s\n", name, strerror(errno));
+        return -1;
+    }
+    
+    char dir[PATH_MAX];
+    const char *slash = strrchr(name, '/');
+    if (!slash) {
+        strcpy(dir, ".");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", slash == name ? 1 : (int)(slash - name), name);
+    }
+    if (inotify_add_watch(m->ifd, dir, IN_CREATE | IN_MOVED_TO) < 0) {
+        DPRINT("Failed to watch directory '%s': %s\n", dir, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Give a handle an (empty) filter stack and the fixed frame-sized buffer
+static int mio_filter_setup(MIO *m) {
+    if (!(m->fs = calloc(1, sizeof(struct mio_fstack)))) {
+        DPRINT("Failed to allocate filter stack\n");
+        return -1;
+    }
+    // one buffer holds one frame; frames are read sequentially
+    int resized = (m->rw == MODE_R) ? mio_resize_rb(m, MIO_FILTER_BSIZE) :
+                                      mio_resize_wb(m, MIO_FILTER_BSIZE);
+    if (resized < 0) {
+        free(m->fs);
+        m->fs = NULL;
+        return -1;
+    }
+    m->flags &= ~MIO_CACHED;
+    m->flags |= MIO_FILTER;
+    return 0;
+}
+
+// Block-indexed container: the magic, frames {rawlen, enclen} + data, the
+// index (one entry {offset, rawlen, enclen, records} per frame), the codec
+// table (the name of each filter in push order, NUL padded) and a trailer
+// {index offset, entries, flags, filters, magic}; all integers little-endian.
+// No flags are defined yet; readers reject any that are set.
+#define MIO_INDEX_MAGIC "MIOBLK2"	// 8 bytes with the NUL
+#define MIO_INDEX_ENTRY 24
+#define MIO_INDEX_NAME 16
+#define MIO_INDEX_TRAILER 32
+
+// Filters a reader sets up by itself from the codec table
+static const struct mio_filter *const mio_builtin_filters[] = { &mio_filter_lz, &mio_filter_crc };
+
+// Push the built-in filters the container names next, up to the first one
+// the caller has to supply
+static void mio_index_codecs(MIO *m) {
+    struct mio_fstack *fs = m->fs;
+    while (fs->n < fs->ncodec) {
+        const struct mio_filter *f = NULL;
+        for (size_t i = 0; i < sizeof(mio_builtin_filters) / sizeof(mio_builtin_filters[0]); i++) {
+            if (strncmp(mio_builtin_filters[i]->name, fs->codec[fs->n], MIO_INDEX_NAME) == 0) {
+                f = mio_builtin_filters[i];
+            }
+        }
+        if (!f) {
+            DPRINT("Container needs filter '%.16s'\n", fs->codec[fs->n]);
+            return;
+        }
+        fs->f[fs->n++] = f;
+    }
+}
+
+static void mio_put64le(unsigned char *p, uint64_t v) {
+    mio_put32le(p, (uint32_t)v);
+    mio_put32le(p + 4, (uint32_t)(v >> 32));
+}
+
+// Writers start the file with the magic; readers load and check the index
+static int mio_setup_indexed(MIO *m) {
+    if (mio_filter_setup(m) < 0) {
+        return -1;
+    }
+    m->flags |= MIO_INDEXED;
+    struct mio_fstack *fs = m->fs;
+    if (m->rw != MODE_R) {
+        if (mio_syswrite(m, MIO_INDEX_MAGIC, 8) != 8) {
+            DPRINT("Failed to write container header\n");
+            return -1;
+        }
+        fs->woff = 8;
+        return 0;
+    }
+    
+    unsigned char t[MIO_INDEX_TRAILER];
+    char magic[8];
+    struct stat st;
+    if (fstat(m->fd, &st) < 0 || st.st_size < 8 + MIO_INDEX_TRAILER ||
+        pread(m->fd, magic, 8, 0) != 8 || memcmp(magic, MIO_INDEX_MAGIC, 8) != 0 ||
+        pread(m->fd, t, sizeof(t), st.st_size - MIO_INDEX_TRAILER) != (ssize_t)sizeof(t) ||
+        memcmp(t + 24, MIO_INDEX_MAGIC, 8) != 0) {
+        DPRINT("Not a block-indexed container\n");
+        errno = EBADMSG;
+        return -1;
+    }
+    uint64_t at = mio_le64(t), n = mio_le64(t + 8);
+    uint32_t cflags = mio_le32(t + 16), ncodec = mio_le32(t + 20);
+    if (cflags != 0 || ncodec > MIO_FILTER_MAX) {
+        DPRINT("Container uses unsupported flags %#x or %u filters\n", cflags, ncodec);
+        errno = ENOTSUP;
+        return -1;
+    }
+    off_t ixend = st.st_size - MIO_INDEX_TRAILER - (off_t)ncodec * MIO_INDEX_NAME;
+    if (ixend < 8 || at < 8 || at > (uint64_t)ixend || n != ((uint64_t)ixend - at) / MIO_INDEX_ENTRY ||
+        (uint64_t)ixend - at != n * MIO_INDEX_ENTRY ||
+        pread(m->fd, fs->codec, ncodec * MIO_INDEX_NAME, ixend) != (ssize_t)(ncodec * MIO_INDEX_NAME)) {
+        DPRINT("Corrupt container trailer\n");
+        errno = EBADMSG;
+        return -1;
+    }
+    fs->ncodec = (int)ncodec;
+    mio_index_codecs(m);
+    
+    unsigned char *ix = malloc(n ? n * MIO_INDEX_ENTRY : 1);
+    fs->blk = malloc(n ? n * sizeof(struct mio_block) : 1);
+    if (!ix || !fs->blk) {
+        DPRINT("Failed to allocate the block index\n");
+        free(ix);
+        return -1;
+    }
+    if (pread(m->fd, ix, n * MIO_INDEX_ENTRY, (off_t)at) != (ssize_t)(n * MIO_INDEX_ENTRY)) {
+        DPRINT("Failed to read the block index\n");
+        free(ix);
+        errno = EBADMSG;
+        return -1;
+    }
+    off_t next = 8, rawoff = 0;
+    for (size_t i = 0; i < n; i++) {
+        const unsigned char *e = ix + i * MIO_INDEX_ENTRY;
+        struct mio_block *b = &fs->blk[i];
+        b->offset = (off_t)mio_le64(e);
+        b->rawlen = mio_le32(e + 8);
+        b->enclen = mio_le32(e + 12);
+        b->records = mio_le32(e + 16);
+        b->rawoff = rawoff;
+        // blocks are stored back to back in index order
+        if (b->offset != next || b->rawlen > MIO_FILTER_BSIZE) {
+            DPRINT("Corrupt index entry %zu\n", i);
+            free(ix);
+            errno = EBADMSG;
+            return -1;
+        }
+        next += MIO_FRAME_HDR + (off_t)b->enclen;
+        rawoff += (off_t)b->rawlen;
+    }
+    free(ix);
+    if (next != (off_t)at || lseek(m->fd, 8, SEEK_SET) < 0) {
+        DPRINT("Block index does not match the data\n");
+        errno = EBADMSG;
+        return -1;
+    }
+    fs->nblk = fs->blkcap = n;
+    DPRINT("Loaded index of %zu blocks\n", fs->nblk);
+    return 0;
+}
+
+// Append the index and trailer after the last frame of an indexed writer
+static int mio_index_finish(MIO *m) {
+    struct mio_fstack *fs = m->fs;
+    size_t size = fs->nblk * MIO_INDEX_ENTRY + (size_t)fs->n * MIO_INDEX_NAME + MIO_INDEX_TRAILER;
+    unsigned char *ix = calloc(1, size);
+    if (!ix) {
+        DPRINT("Failed to allocate the block index\n");
+        return -1;
+    }
+    for (size_t i = 0; i < fs->nblk; i++) {
+        unsigned char *e = ix + i * MIO_INDEX_ENTRY;
+        mio_put64le(e, (uint64_t)fs->blk[i].offset);
+        mio_put32le(e + 8, (uint32_t)fs->blk[i].rawlen);
+        mio_put32le(e + 12, (uint32_t)fs->blk[i].enclen);
+        mio_put32le(e + 16, (uint32_t)fs->blk[i].records);
+    }
+    unsigned char *c = ix + fs->nblk * MIO_INDEX_ENTRY;
+    for (int i = 0; i < fs->n; i++, c += MIO_INDEX_NAME) {
+        strncpy((char *)c, fs->f[i]->name, MIO_INDEX_NAME);
+    }
+    unsigned char *t = c;
+    mio_put64le(t, (uint64_t)fs->woff);
+    mio_put64le(t + 8, fs->nblk);
+    mio_put32le(t + 16, 0);
+    mio_put32le(t + 20, (uint32_t)fs->n);
+    memcpy(t + 24, MIO_INDEX_MAGIC, 8);
+    
+    size_t done = 0;
+    while (done < size) {
+        ssize_t put = mio_syswrite(m, (char *)ix + done, size - done);
+        if (put < 0) {
+            DPRINT("Failed to write the block index: %s\n", strerror(errno));
+            free(ix);
+            return -1;
+        }
+        done += (size_t)put;
+    }
+    free(ix);
+    DPRINT("Wrote index of %zu blocks\n", fs->nblk);
+    return 0;
+}
 
 // Open file with specified mode
 MIO *myopen(const char *name, const int mode) {
-    // Allocate memory for MIO structure
-    MIO *mio = malloc(sizeof(MIO));
+    int flags = 0;
+    int create_mode = 0644;  // Default file permissions
+    int direct = mode & MODE_DIRECT;
+    int follow = mode & MODE_FOLLOW;
+    int indexed = mode & MODE_INDEXED;
+    
+    if (indexed && (direct || follow)) {
+        DPRINT("MODE_INDEXED cannot be combined with MODE_DIRECT or MODE_FOLLOW\n");
+        return NULL;
+    }
+    
+    // Set flags based on requested mode
+    switch (mode & ~(MODE_DIRECT | MODE_FOLLOW | MODE_INDEXED)) {
+        case MODE_R:
+            if (follow && direct) {
+                DPRINT("MODE_FOLLOW cannot be combined with MODE_DIRECT\n");
+                return NULL;
+            }
+            flags = O_RDONLY;
+            break;
+        case MODE_WA:
+            if (follow || indexed) {
+                DPRINT("MODE_FOLLOW is for reading only, MODE_INDEXED cannot append\n");
+                return NULL;
+            }
+            // direct appends rewrite the unaligned tail block, so no O_APPEND
+            flags = direct ? O_RDWR | O_CREAT : O_WRONLY | O_CREAT | O_APPEND;
+            break;
+        case MODE_WT:
+            if (follow) {
+                DPRINT("MODE_FOLLOW is for reading only\n");
+                return NULL;
+            }
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+            break;
+        default:
+            DPRINT("Invalid mode specified: %d\n", mode);
+            return NULL;
+    }
+    
+    // Allocate MIO structure and both buffers in a single pooled block
+    MIO *mio = mio_alloc(direct ? 0 : MBSIZE);
+    if (!mio) {
+        DPRINT("Failed to allocate MIO structure\n");
+        return NULL;
+    }
+    
+    // Open the file using low-level system call; offsets are 64-bit
+    flags |= O_LARGEFILE;
+    mio->fd = open(name, direct ? flags | O_DIRECT : flags, create_mode);
+    if (mio->fd < 0 && direct && errno == EINVAL) {
+        // filesystem without O_DIRECT support: keep the aligned buffering
+        DPRINT("O_DIRECT not supported for '%s', using the page cache\n", name);
+        mio->fd = open(name, flags, create_mode);
+    }
+    if (mio->fd < 0) {
+        DPRINT("Failed to open file '%s': %s\n", name, strerror(errno));
+        mio_release(mio);
+        return NULL;
+    }
+    
+    // Initialize MIO structure fields
+    mio->rw = mode & ~(MODE_DIRECT | MODE_FOLLOW | MODE_INDEXED);
+    mio->rs = 0;  // Read buffer start position
+    mio->re = 0;  // Read buffer end position (amount of valid data)
+    mio->ws = 0;  // Write buffer current position
+    mio->we = 0;  // Write buffer end position
+    
+    // Appends continue at the current end of the file
+    if (mio->rw == MODE_WA && !direct) {
+        off_t end = lseek(mio->fd, 0, SEEK_END);
+        mio->pos = end > 0 ? end : 0;
+    }
+    
+    if ((direct && mio_setup_direct(mio) < 0) || (follow && mio_setup_follow(mio, name) < 0) ||
+        (indexed && mio_setup_indexed(mio) < 0)) {
+        close(mio->fd);
+        mio_release(mio);
+        return NULL;
+    }
+    
+    // Readers of regular files share blocks through the cache when enabled
+    struct stat st;
+    if (mio->rw == MODE_R && !direct && !follow && !indexed && mio_cache_npages &&
+        fstat(mio->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        mio->dev = st.st_dev;
+        mio->ino = st.st_ino;
+        mio->mtime = st.st_mtim;
+        mio->flags |= MIO_CACHED;
+    }
+    
+    DPRINT("Successfully opened file '%s' in mode %d\n", name, mode);
+    return mio;
+}
+
+// Buffer an already open descriptor (pipe, socket, stdin/stdout, ...). The
+// handle takes ownership: myclose() closes fd. MODE_WA and MODE_WT both just
+// write at the descriptor's current position.
+MIO *myfdopen(int fd, int mode) {
+    if (fd < 0 || fcntl(fd, F_GETFL) < 0) {
+        DPRINT("Invalid file descriptor %d\n", fd);
+        return NULL;
+    }
+    
+    if (mode != MODE_R && !M_ISMW(mode)) {
+        DPRINT("Invalid mode specified: %d\n", mode);
+        return NULL;
+    }
+    
+    MIO *mio = mio_alloc(MBSIZE);
+    if (!mio) {
+        DPRINT("Failed to allocate MIO structure\n");
+        return NULL;
+    }
+    mio->fd = fd;
+    mio->rw = mode;
+    // positions count from the descriptor's offset; pipes and sockets from 0
+    off_t cur = lseek(fd, 0, SEEK_CUR);
+    mio->pos = cur > 0 ? cur : 0;
+    
+    DPRINT("Opened descriptor %d in mode %d\n", fd, mode);
+    return mio;
+}
+
+// Open a stream over a caller-provided memory region. Reads are served straight
+// from buf and writes land in it; nothing is copied and no descriptor is used.
+MIO *mymemopen(void *buf, size_t len, int mode) {
+    if (!buf || len > SSIZE_MAX) {
+        DPRINT("Invalid parameters to mymemopen\n");
+        return NULL;
+    }
+    
+    if (mode != MODE_R && !M_ISMW(mode)) {
+        DPRINT("Invalid mode specified: %d\n", mode);
+        return NULL;
+    }
+    
+    // Only the structure comes from the pool; the region is the buffer
+    MIO *mio = mio_alloc(0);
+    if (!mio) {
+        DPRINT("Failed to allocate MIO structure\n");
+        return NULL;
+    }
+    mio->flags |= MIO_MEM;
+    mio->rw = mode;
+    
+    if (mode == MODE_R) {
+        mio->rb = buf;
+        mio->rsize = len;
+        mio->re = len;
+    } else {
+        mio->wb = buf;
+        mio->wsize = len;
+        // append continues after the string already in the region
+        mio->ws = (mode == MODE_WA) ? strnlen(buf, len) : 0;
+        mio->pos = (off_t)mio->ws;
+    }
+    
+    DPRINT("Opened memory stream of %zu bytes in mode %d\n", len, mode);
+    return mio;
+}
+
+// Header in front of a growable memory stream buffer
+struct mio_memhdr {
+    size_t cap;		// bytes allocated, header included
+    int mapped;		// 1 - anonymous mapping, 0 - malloc
+};
+
+// Make the buffer visible to the owner of a growable memory stream
+static void mio_mempublish(MIO *m) {
+    m->wb[m->ws] = '\0';
+    *m->mbufp = m->wb;
+    *m->msizep = m->ws;
+}
+
+// Grow a memory stream so it can hold at least 'need' bytes plus a NUL.
+// Growth is geometric; from MIO_MEMMAP_MIN on the buffer lives in an anonymous
+// mapping that mremap() can extend without copying the data.
+static int mio_memgrow(MIO *m, size_t need) {
+    struct mio_memhdr *hdr = (struct mio_memhdr *)(m->wb - MIO_MEMHDR);
+    size_t want = MIO_MEMHDR + need + 1;
+    if (need > SSIZE_MAX / 2) {
+        DPRINT("Memory stream would exceed %zd bytes\n", SSIZE_MAX / 2);
+        errno = EFBIG;
+        return -1;
+    }
+    
+    size_t cap = hdr->cap;
+    while (cap < want) {
+        cap *= 2;
+    }
+    void *block;
+    if (cap >= MIO_MEMMAP_MIN) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        cap = (cap + page - 1) / page * page;
+        if (hdr->mapped) {
+            block = mremap(hdr, hdr->cap, cap, MREMAP_MAYMOVE);
+        } else {
+            // one last copy when moving from the heap to a mapping
+            block = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (block != MAP_FAILED) {
+                memcpy(block, hdr, MIO_MEMHDR + m->ws);
+                free(hdr);
+            }
+        }
+        if (block == MAP_FAILED) {
+            DPRINT("Failed to map %zu bytes: %s\n", cap, strerror(errno));
+            return -1;
+        }
+    } else {
+        block = realloc(hdr, cap);
+        if (!block) {
+            DPRINT("Failed to grow memory stream to %zu bytes\n", cap);
+            return -1;
+        }
+    }
+    
+    hdr = block;
+    hdr->cap = cap;
+    hdr->mapped = cap >= MIO_MEMMAP_MIN;
+    m->wb = (char *)block + MIO_MEMHDR;
+    m->wsize = cap - MIO_MEMHDR - 1;
+    DPRINT("Memory stream grown to %zu bytes\n", cap);
+    return 0;
+}
+
+// Open a write stream into a growing memory buffer (open_memstream equivalent).
+// *bufp and *sizep are updated by myflush() and myclose(); the buffer is always
+// NUL terminated, belongs to the caller after myclose() and is released with
+// mymemfree().
+MIO *mymemstream(char **bufp, size_t *sizep) {
+    if (!bufp || !sizep) {
+        DPRINT("Invalid parameters to mymemstream\n");
+        return NULL;
+    }
+    
+    struct mio_memhdr *hdr = malloc(MIO_MEMHDR + MIO_MEMSTREAM_INIT);
+    if (!hdr) {
+        DPRINT("Failed to allocate memory stream buffer\n");
+        return NULL;
+    }
+    hdr->cap = MIO_MEMHDR + MIO_MEMSTREAM_INIT;
+    hdr->mapped = 0;
+    
+    MIO *mio = mio_alloc(0);
     if (!mio) {
         DPRINT("Failed to allocate MIO structure\n");
+        free(hdr);
+        return NULL;
+    }
+    mio->flags |= MIO_MEM | MIO_GROW;
+    mio->rw = MODE_WT;
+    mio->wb = (char *)hdr + MIO_MEMHDR;
+    mio->wsize = MIO_MEMSTREAM_INIT - 1;
+    mio->mbufp = bufp;
+    mio->msizep = sizep;
+    mio_mempublish(mio);
+    
+    DPRINT("Opened growable memory stream\n");
+    return mio;
+}
+
+// Release a buffer handed out by a growable memory stream
+void mymemfree(char *buf) {
+    if (!buf) {
+        return;
+    }
+    struct mio_memhdr *hdr = (struct mio_memhdr *)(buf - MIO_MEMHDR);
+    if (hdr->mapped) {
+        munmap(hdr, hdr->cap);
+    } else {
+        free(hdr);
+    }
+}
+
+// Close file and free resources
+int myclose(MIO *m) {
+    if (!m) {
+        DPRINT("Attempt to close NULL MIO pointer\n");
+        return -1;
+    }
+    
+    int result = 0;
+    
+    // Closing always drains the write buffer, even in non-blocking mode
+    m->flags &= ~MIO_NONBLOCK;
+    
+    // If file was opened for writing, flush any remaining data
+    if (M_ISMW(m->rw) && (m->ws > 0 || (m->flags & (MIO_GROW | MIO_PARALLEL)))) {
+        DPRINT("Flushing write buffer before close\n");
+        if (myflush(m) < 0) {
+            DPRINT("Failed to flush buffer during close\n");
+            result = -1;
+        }
+    }
+    if ((m->flags & MIO_INDEXED) && m->rw != MODE_R && mio_index_finish(m) < 0) {
+        result = -1;
+    }
+    
+    // Close the file descriptor (memory streams have none)
+    if (m->fd >= 0 && close(m->fd) < 0) {
+        DPRINT("Failed to close file descriptor: %s\n", strerror(errno));
+        result = -1;
+    }
+    
+    // Return the MIO structure and its buffers to the pool
+    mio_release(m);
+    
+    DPRINT("File closed successfully\n");
+    return result;
+}
+
+// Refill the read buffer; returns bytes buffered, 0 at EOF, -1 on error or
+// MIO_WOULDBLOCK in non-blocking mode
+static ssize_t mio_refill(MIO *m) {
+    if (m->flags & MIO_MEM) {
+        // the whole memory region already is the buffer
+        return 0;
+    }
+    
+    ssize_t n = mio_input(m, m->rb, m->rsize);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            DPRINT("Read would block\n");
+            return MIO_WOULDBLOCK;
+        }
+        DPRINT("Read error: %s\n", strerror(errno));
+        return -1;
+    }
+    m->rs = 0;
+    m->re = (size_t)n;
+    return n;
+}
+
+// Make at least n unread bytes contiguous in rb (fewer only at end of file):
+// the unread part moves to the front of rb, rb grows when it is too small,
+// and the free tail is read into. Returns the unread bytes now buffered, -1 on
+// error or MIO_WOULDBLOCK.
+static ssize_t mio_fill(MIO *m, size_t n) {
+    while (m->re - m->rs < n) {
+        // a memory region has nothing behind it, and a short direct read
+        // leaves rb unaligned for the next one
+        if ((m->flags & MIO_MEM) || ((m->flags & MIO_DIRECT) && m->re % m->dalign)) {
+            break;
+        }
+        if (m->re == m->rsize) {
+            size_t from = (m->flags & MIO_DIRECT) ? m->rs - m->rs % m->dalign : m->rs;
+            size_t need = m->rs - from + n;
+            if (need > m->rsize) {
+                size_t size = need > 2 * m->rsize ? need : 2 * m->rsize;
+                if (m->flags & MIO_DIRECT) {
+                    size = (size + m->dalign - 1) / m->dalign * m->dalign;
+                }
+                if (mio_resize_rb(m, size) < 0) {
+                    return -1;
+                }
+            } else {
+                memmove(m->rb, m->rb + from, m->re - from);
+                m->rs -= from;
+                m->re -= from;
+            }
+        }
+        
+        ssize_t got = mio_input(m, m->rb + m->re, m->rsize - m->re);
+        if (got < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return MIO_WOULDBLOCK;
+            }
+            DPRINT("Read error: %s\n", strerror(errno));
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        m->re += (size_t)got;
+    }
+    return (ssize_t)(m->re - m->rs);
+}
+
+// Read data from file into buffer; any size up to SSIZE_MAX in one call
+ssize_t myread64(MIO *m, char *b, size_t size) {
+    if (!m || !b || size > SSIZE_MAX) {
+        DPRINT("Invalid parameters to myread64\n");
+        return -1;
+    }
+    
+    if (m->rw != MODE_R) {
+        DPRINT("File not opened for reading\n");
+        return -1;
+    }
+    
+    size_t total_read = 0;
+    
+    while (total_read < size) {
+        // If read buffer is empty, refill it from file
+        if (m->rs >= m->re) {
+            ssize_t filled = mio_refill(m);
+            if (filled == MIO_WOULDBLOCK) {
+                return total_read > 0 ? (ssize_t)total_read : MIO_WOULDBLOCK;
+            }
+            if (filled < 0) {
+                return -1;
+            }
+            if (filled == 0) {
+                // End of file reached
+                DPRINT("EOF reached, read %zu bytes\n", total_read);
+                return total_read > 0 ? (ssize_t)total_read : -1;
+            }
+        }
+        
+        // Calculate how many bytes we can copy from buffer
+        size_t available = m->re - m->rs;
+        size_t needed = size - total_read;
+        size_t to_copy = (available < needed) ? available : needed;
+        
+        // Copy data from read buffer to user buffer
+        memcpy(b + total_read, m->rb + m->rs, to_copy);
+        m->rs += to_copy;
+        m->pos += (off_t)to_copy;
+        total_read += to_copy;
+    }
+    
+    DPRINT("Read %zu bytes from file\n", total_read);
+    return (ssize_t)total_read;
+}
+
+// Read data from file into buffer
+int myread(MIO *m, char *b, const int size) {
+    if (size < 0) {
+        DPRINT("Invalid parameters to myread\n");
+        return -1;
+    }
+    return (int)myread64(m, b, (size_t)size);
+}
+
+// Read single character from file
+int mygetc(MIO *m, char *c) {
+    if (!m || !c) {
+        DPRINT("Invalid parameters to mygetc\n");
+        return -1;
+    }
+    
+    // Use myread to get one character
+    int result = myread(m, c, 1);
+    if (result == 1) {
+        DPRINT("Read character: %c\n", *c);
+    } else {
+        DPRINT("Failed to read character\n");
+    }
+    return result;
+}
+
+// Read string until whitespace
+char *mygets(MIO *m, int *len) {
+    if (!m) {
+        DPRINT("Invalid MIO pointer to mygets\n");
+        return NULL;
+    }
+    
+    // Skip leading whitespace
+    char ch;
+    int result;
+    do {
+        result = mygetc(m, &ch);
+        if (result < 0) {
+            DPRINT("EOF reached while skipping whitespace\n");
+            return NULL;
+        }
+    } while (M_ISWS(ch));
+    
+    // Allocate buffer for the string
+    char *buffer = malloc(MBSIZE);
+    if (!buffer) {
+        DPRINT("Failed to allocate string buffer\n");
+        return NULL;
+    }
+    
+    int pos = 0;
+    buffer[pos++] = ch;  // Add the first non-whitespace character
+    
+    // Read until next whitespace or buffer full
+    while (pos < MBSIZE - 1) {
+        result = mygetc(m, &ch);
+        if (result != 1) {
+            break;  // EOF or error
+        }
+        
+        // Stop at whitespace
+        if (M_ISWS(ch)) {
+            break;
+        }
+        
+        buffer[pos++] = ch;
+    }
+    
+    buffer[pos] = '\0';  // Null terminate the string
+    
+    if (len) {
+        *len = pos;
+    }
+    
+    DPRINT("Read string: '%s' (length: %d)\n", buffer, pos);
+    return buffer;
+}
+
+// Read one line of any length, without its newline, into a malloc'd string.
+// Returns NULL at end of file, on error, or with errno EAGAIN when a follow or
+// non-blocking handle has no complete line yet (the partial line stays buffered).
+char *mygetline(MIO *m, size_t *len) {
+    if (!m || m->rw != MODE_R) {
+        DPRINT("Invalid parameters to mygetline\n");
+        return NULL;
+    }
+    
+    // Scan with memchr, only looking at newly buffered bytes on each round
+    size_t scanned = 0;
+    char *nl = NULL;
+    for (;;) {
+        nl = memchr(m->rb + m->rs + scanned, MNLINE, m->re - m->rs - scanned);
+        if (nl) {
+            break;
+        }
+        scanned = m->re - m->rs;
+        ssize_t avail = mio_fill(m, scanned + 1);
+        if (avail == MIO_WOULDBLOCK) {
+            errno = EAGAIN;
+            return NULL;
+        }
+        if (avail < 0) {
+            return NULL;
+        }
+        if ((size_t)avail <= scanned) {
+            break;  // end of file: the last line has no newline
+        }
+    }
+    
+    size_t n = nl ? (size_t)(nl - (m->rb + m->rs)) : m->re - m->rs;
+    if (!nl && n == 0) {
+        DPRINT("EOF reached, no more lines\n");
+        return NULL;
+    }
+    char *line = malloc(n + 1);
+    if (!line) {
+        DPRINT("Failed to allocate %zu byte line\n", n + 1);
+        return NULL;
+    }
+    memcpy(line, m->rb + m->rs, n);
+    line[n] = '\0';
+    
+    size_t used = n + (nl != NULL);
+    m->rs += used;
+    m->pos += (off_t)used;
+    if (len) {
+        *len = n;
+    }
+    DPRINT("Read line of %zu bytes\n", n);
+    return line;
+}
+
+// Load the aligned block that precedes rb[0] in the file in front of the data
+// before the cursor, for reading backwards; bytes after the cursor are dropped.
+// Returns the bytes loaded, 0 at the start of the file or -1 on error.
+static ssize_t mio_reverse_load(MIO *m) {
+    off_t base = m->pos - (off_t)m->rs;  // file offset of rb[0]
+    if (base <= 0 || (m->flags & MIO_MEM)) {
+        return 0;
+    }
+    off_t from = (base - 1) / MIO_REVERSE_BSIZE * MIO_REVERSE_BSIZE;
+    size_t n = (size_t)(base - from);
+    
+    // Make room for the block in front of the carried part of the line
+    size_t need = n + m->rs;
+    if (need > m->rsize) {
+        size_t size = need > 2 * m->rsize ? need : 2 * m->rsize;
+        char *rb = malloc(size);
+        if (!rb) {
+            DPRINT("Failed to allocate %zu byte read buffer\n", size);
+            return -1;
+        }
+        memcpy(rb + n, m->rb, m->rs);
+        if (m->flags & MIO_OWNRB) {
+            free(m->rb);
+        }
+        m->rb = rb;
+        m->rsize = size;
+        m->flags |= MIO_OWNRB;
+    } else {
+        memmove(m->rb + n, m->rb, m->rs);
+    }
+    
+    size_t done = 0;
+    while (done < n) {
+        ssize_t got = pread(m->fd, m->rb + done, n - done, from + (off_t)done);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            DPRINT("Failed to read block at %lld: %s\n", (long long)from, got < 0 ? strerror(errno) : "EOF");
+            memmove(m->rb, m->rb + n, m->rs);
+            return -1;
+        }
+        done += (size_t)got;
+    }
+    m->rs += n;
+    m->re = m->rs;
+    // forward reads continue right behind the buffered data
+    if (lseek(m->fd, m->pos, SEEK_SET) < 0) {
+        return -1;
+    }
+    DPRINT("Loaded %zu bytes at %lld for reverse reading\n", n, (long long)from);
+    return (ssize_t)n;
+}
+
+// Read the line that ends at the current position, moving backwards, so lines
+// come last to first; start at the end with myseek(m, 0, SEEK_END). A newline
+// right before the position ends that line and is not part of it, so a file
+// ending in a newline does not yield an empty last line. Returns NULL once the
+// start of the file is reached or on error.
+char *mygetline_reverse(MIO *m, size_t *len) {
+    if (!m || m->rw != MODE_R || (m->flags & (MIO_DIRECT | MIO_FILTER))) {
+        DPRINT("Invalid parameters to mygetline_reverse\n");
+        return NULL;
+    }
+    
+    if (m->rs == 0 && mio_reverse_load(m) <= 0) {
+        DPRINT("Start of file reached, no more lines\n");
+        return NULL;
+    }
+    size_t term = (m->rb[m->rs - 1] == MNLINE);
+    
+    // Search back with memrchr, loading earlier blocks until a newline shows up
+    size_t clean = 0;  // bytes before the end of the line known to hold no newline
+    char *nl = NULL;
+    for (;;) {
+        size_t end = m->rs - term;
+        nl = memrchr(m->rb, MNLINE, end - clean);
+        if (nl) {
+            break;
+        }
+        clean = end;
+        ssize_t got = mio_reverse_load(m);
+        if (got < 0) {
+            return NULL;
+        }
+        if (got == 0) {
+            break;  // the first line of the file
+        }
+    }
+    
+    size_t start = nl ? (size_t)(nl + 1 - m->rb) : 0;
+    size_t n = m->rs - term - start;
+    char *line = malloc(n + 1);
+    if (!line) {
+        DPRINT("Failed to allocate %zu byte line\n", n + 1);
+        return NULL;
+    }
+    memcpy(line, m->rb + start, n);
+    line[n] = '\0';
+    
+    m->pos -= (off_t)(m->rs - start);
+    m->rs = start;
+    if (len) {
+        *len = n;
+    }
+    DPRINT("Read line of %zu bytes backwards\n", n);
+    return line;
+}
+
+// Apply the handle's buffering policy after 'size' bytes from b were buffered
+static int mio_policy_flush(MIO *m, const char *b, size_t size) {
+    int flush = 0;
+    switch (m->bufmode) {
+        case MIO_LINEBUF:
+            // memrchr scans the chunk word-at-a-time / with SIMD in libc
+            flush = size > 0 && memrchr(b, MNLINE, size) != NULL;
+            break;
+        case MIO_NOBUF:
+            flush = 1;
+            break;
+        case MIO_TIMEBUF:
+            if (m->ws > 0 && m->wsince == 0) {
+                m->wsince = mio_now_us();
+            } else if (m->ws > 0) {
+                flush = mio_now_us() - m->wsince >= m->maxdelay;
+            }
+            break;
+    }
+    if (!flush || m->ws == 0) {
+        return 0;
+    }
+    int flushed = myflush(m);
+    return (flushed < 0 && flushed != MIO_WOULDBLOCK) ? -1 : 0;
+}
+
+// Free space after the ring tail, up to the end of wb or the head; the
+// tail's index goes to *tail
+static size_t mio_wfree(MIO *m, size_t *tail) {
+    size_t t = m->wh + m->ws;
+    if (t >= m->wsize) {
+        t -= m->wsize;
+    }
+    *tail = t;
+    return (t >= m->wh && m->ws < m->wsize) ? m->wsize - t : m->wh - t;
+}
+
+// Make room in a full write buffer: direct writers keep their unaligned
+// tail, parallel writers hand the buffer to a worker
+static ssize_t mio_wdrain(MIO *m) {
+    if (m->flags & MIO_DIRECT) {
+        return mio_flush_direct(m, 0);
+    }
+    if (m->flags & MIO_PARALLEL) {
+        return mio_workers_submit(m);
+    }
+    return myflush(m);
+}
+
+// Write data to file; any size up to SSIZE_MAX in one call
+ssize_t mywrite64(MIO *m, const char *b, size_t size) {
+    if (!m || !b || size > SSIZE_MAX) {
+        DPRINT("Invalid parameters to mywrite64\n");
+        return -1;
+    }
+    
+    if (!M_ISMW(m->rw)) {
+        DPRINT("File not opened for writing\n");
+        return -1;
+    }
+    
+    size_t total_written = 0;
+    m->wres = 0;  // writing cancels a reservation
+    
+    // Growable memory streams make room for the whole write up front
+    if ((m->flags & MIO_GROW) && size > m->wsize - m->ws) {
+        if (mio_memgrow(m, m->ws + size) < 0) {
+            return -1;
+        }
+    }
+    
+    while (total_written < size) {
+        size_t tail;
+        size_t available = mio_wfree(m, &tail);
+        size_t remaining = size - total_written;
+        size_t to_copy = (available < remaining) ? available : remaining;
+        
+        // Copy data to write buffer
+        memcpy(m->wb + tail, b + total_written, to_copy);
+        m->ws += to_copy;
+        m->pos += (off_t)to_copy;
+        total_written += to_copy;
+        
+        // If buffer is full, flush it
+        if (m->ws >= m->wsize) {
+            if (m->flags & MIO_MEM) {
+                // a fixed memory region has nowhere to flush to
+                if (total_written < size) {
+                    DPRINT("Memory stream full after %zu bytes\n", total_written);
+                    errno = ENOSPC;
+                    return total_written > 0 ? (ssize_t)total_written : -1;
+                }
+            } else {
+                ssize_t flushed = mio_wdrain(m);
+                if (flushed == MIO_WOULDBLOCK && m->ws >= m->wsize) {
+                    // no room freed: report what was accepted so far
+                    return total_written > 0 ? (ssize_t)total_written : MIO_WOULDBLOCK;
+                }
+                if (flushed < 0 && flushed != MIO_WOULDBLOCK) {
+                    DPRINT("Failed to flush buffer during write\n");
+                    return -1;
+                }
+            }
+        }
+    }
+    
+    if (m->bufmode != MIO_FULLBUF && mio_policy_flush(m, b, size) < 0) {
+        return -1;
+    }
+    
+    DPRINT("Buffered %zu bytes for writing\n", total_written);
+    return (ssize_t)total_written;
+}
+
+// Write data to file
+int mywrite(MIO *m, const char *b, const int size) {
+    if (size < 0) {
+        DPRINT("Invalid parameters to mywrite\n");
+        return -1;
+    }
+    return (int)mywrite64(m, b, (size_t)size);
+}
+
+// Reserve n contiguous bytes in the write buffer for the caller to fill in
+// place, flushing or growing wb as needed; the bytes become part of the
+// stream with mywrite_commit(). Other writes cancel the reservation.
+// Direct handles keep their unaligned tail in wb across flushes, so they can
+// reserve at most wsize - ws % alignment bytes; larger requests fail with
+// EINVAL rather than EAGAIN.
+char *mywrite_reserve(MIO *m, size_t n) {
+    if (!m || !M_ISMW(m->rw) || n == 0 || n > SSIZE_MAX) {
+        DPRINT("Invalid parameters to mywrite_reserve\n");
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((m->flags & MIO_DIRECT) && n > m->wsize - m->ws % m->dalign) {
+        DPRINT("Direct handle can reserve at most %zu bytes\n", m->wsize - m->ws % m->dalign);
+        errno = EINVAL;
+        return NULL;
+    }
+    
+    if ((m->flags & MIO_GROW) && n > m->wsize - m->ws && mio_memgrow(m, m->ws + n) < 0) {
         return NULL;
     }
+    size_t tail;
+    if (mio_wfree(m, &tail) < n && !(m->flags & MIO_MEM)) {
+        if (m->ws > 0) {
+            ssize_t flushed = mio_wdrain(m);
+            if (flushed < 0 && flushed != MIO_WOULDBLOCK) {
+                DPRINT("Failed to flush buffer for reservation\n");
+                return NULL;
+            }
+        }
+        if (m->ws == 0) {
+            m->wh = 0;
+            // fixed-size buffers cannot grow past their frame or alignment
+            if (n > m->wsize && !(m->flags & (MIO_DIRECT | MIO_FILTER)) && mio_resize_wb(m, n) < 0) {
+                return NULL;
+            }
+        }
+    }
+    if (mio_wfree(m, &tail) < n) {
+        DPRINT("Cannot reserve %zu contiguous bytes\n", n);
+        errno = (m->flags & MIO_MEM) ? ENOSPC : (m->ws > 0) ? EAGAIN : EINVAL;
+        return NULL;
+    }
+    m->wres = n;
+    m->wresoff = tail;
+    return m->wb + tail;
+}
+
+// Append the first 'used' bytes of the last reservation to the stream. Any
+// other write, flush or seek in between cancels the reservation, and the
+// commit then fails with EINVAL.
+int mywrite_commit(MIO *m, size_t used) {
+    if (!m || used > m->wres) {
+        DPRINT("Invalid parameters to mywrite_commit\n");
+        errno = EINVAL;
+        return -1;
+    }
+    
+    const char *b = m->wb + m->wresoff;
+    m->wres = 0;
+    m->ws += used;
+    m->pos += (off_t)used;
+    if (m->ws >= m->wsize && !(m->flags & MIO_MEM)) {
+        ssize_t flushed = mio_wdrain(m);
+        if (flushed < 0 && flushed != MIO_WOULDBLOCK) {
+            DPRINT("Failed to flush buffer after commit\n");
+            return -1;
+        }
+    }
+    if (m->bufmode != MIO_FULLBUF && mio_policy_flush(m, b, used) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Total length of an iovec array, -1 if it does not fit an int
+static int mio_iov_total(const struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+        if (total > INT_MAX) {
+            return -1;
+        }
+    }
+    return (int)total;
+}
+
+// Read into several buffers. Buffered data is handed out first; a large
+// remainder is read with readv() straight into the caller's segments, with rb
+// appended as the last segment so the same call also refills the buffer.
+int myreadv(MIO *m, const struct iovec *iov, int iovcnt) {
+    int size = iov ? mio_iov_total(iov, iovcnt) : -1;
+    if (!m || iovcnt < 0 || size < 0) {
+        DPRINT("Invalid parameters to myreadv\n");
+        return -1;
+    }
+    
+    if (m->rw != MODE_R) {
+        DPRINT("File not opened for reading\n");
+        return -1;
+    }
+    
+    // Memory, direct, non-blocking, follow, cached and digest handles go
+    // through myread()
+    if ((m->flags & (MIO_MEM | MIO_DIRECT | MIO_NONBLOCK | MIO_FOLLOW | MIO_CACHED | MIO_DIGEST |
+                     MIO_FILTER)) ||
+        iovcnt >= MIO_IOV_MAX) {
+        int total_read = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            if (iov[i].iov_len == 0) {
+                continue;
+            }
+            int got = myread(m, iov[i].iov_base, (int)iov[i].iov_len);
+            if (got < 0) {
+                return total_read > 0 ? total_read : got;
+            }
+            total_read += got;
+            if (got < (int)iov[i].iov_len) {
+                break;
+            }
+        }
+        return total_read;
+    }
+    
+    struct iovec v[MIO_IOV_MAX];
+    struct iovec *cur = v;
+    int cnt = iovcnt;
+    memcpy(v, iov, sizeof(struct iovec) * iovcnt);
+    
+    // Hand out what is already buffered
+    int total_read = 0;
+    while (cnt > 0 && m->rs < m->re) {
+        size_t available = m->re - m->rs;
+        size_t to_copy = cur->iov_len < available ? cur->iov_len : available;
+        memcpy(cur->iov_base, m->rb + m->rs, to_copy);
+        m->rs += to_copy;
+        m->pos += (off_t)to_copy;
+        total_read += (int)to_copy;
+        mio_iov_advance(&cur, &cnt, to_copy);
+    }
+    
+    // Small remainders are cheaper to serve through the buffer
+    while (total_read < size && (size_t)(size - total_read) < m->rsize) {
+        mio_iov_advance(&cur, &cnt, 0);  // skip empty segments
+        int got = myread(m, cur->iov_base, (int)cur->iov_len);
+        if (got < 0) {
+            return total_read > 0 ? total_read : -1;
+        }
+        total_read += got;
+        mio_iov_advance(&cur, &cnt, got);
+    }
+    
+    if (total_read == size) {
+        return total_read;
+    }
+    
+    // Large remainder: scatter directly, refilling rb with the overshoot
+    if (m->rs == m->re) {
+        m->rs = m->re = 0;
+    }
+    while (total_read < size) {
+        cur[cnt].iov_base = m->rb;
+        cur[cnt].iov_len = m->rsize;
+        ssize_t got = readv(m->fd, cur, cnt + 1);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && mio_wait(m->fd, POLLIN) == 0) {
+                continue;
+            }
+            DPRINT("readv error: %s\n", strerror(errno));
+            return total_read > 0 ? total_read : -1;
+        }
+        if (got == 0) {
+            DPRINT("EOF reached, read %d bytes\n", total_read);
+            return total_read > 0 ? total_read : -1;
+        }
+        ssize_t wanted = size - total_read;
+        if (got > wanted) {
+            // the tail landed in rb
+            m->re = (size_t)(got - wanted);
+            got = wanted;
+        }
+        m->pos += got;
+        total_read += (int)got;
+        mio_iov_advance(&cur, &cnt, (size_t)got);
+    }
+    
+    DPRINT("Read %d bytes into %d segments\n", total_read, iovcnt);
+    return total_read;
+}
+
+// Write several buffers. Segments that fit are copied into wb; otherwise the
+// pending wb data and all segments go out together in one writev() call.
+int mywritev(MIO *m, const struct iovec *iov, int iovcnt) {
+    int size = iov ? mio_iov_total(iov, iovcnt) : -1;
+    if (!m || iovcnt < 0 || size < 0) {
+        DPRINT("Invalid parameters to mywritev\n");
+        return -1;
+    }
+    
+    if (!M_ISMW(m->rw)) {
+        DPRINT("File not opened for writing\n");
+        return -1;
+    }
+    
+    // Coalesce into the write buffer when everything fits, and fall back to
+    // mywrite() for memory, direct, non-blocking and filtered handles
+    int fits = (size_t)size <= m->wsize - m->ws;
+    if (fits || (m->flags & (MIO_MEM | MIO_DIRECT | MIO_NONBLOCK | MIO_FILTER)) || iovcnt >= MIO_IOV_MAX) {
+        int total_written = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            if (iov[i].iov_len == 0) {
+                continue;
+            }
+            int put = mywrite(m, iov[i].iov_base, (int)iov[i].iov_len);
+            if (put < 0) {
+                return total_written > 0 ? total_written : put;
+            }
+            total_written += put;
+            if (put < (int)iov[i].iov_len) {
+                break;
+            }
+        }
+        return total_written;
+    }
+    
+    struct iovec v[MIO_IOV_MAX + 2];
+    struct iovec *cur = v;
+    size_t pending = m->ws;
+    int cnt = pending > 0 ? mio_wsegs(m, v) : 0;
+    memcpy(v + cnt, iov, sizeof(struct iovec) * iovcnt);
+    cnt += iovcnt;
+    
+    size_t done = 0;
+    while (cnt > 0) {
+        ssize_t put = mio_syswritev(m, cur, cnt);
+        if (put < 0) {
+            DPRINT("writev error: %s\n", strerror(errno));
+            // keep unwritten buffered bytes for a later flush
+            if (done < pending) {
+                mio_wconsume(m, done);
+                return -1;
+            }
+            mio_wconsume(m, pending);
+            m->pos += (off_t)(done - pending);
+            return done > pending ? (int)(done - pending) : -1;
+        }
+        if (m->flags & MIO_DIGEST) {
+            mio_digest_iov(m->dg, cur, (size_t)put);
+        }
+        done += (size_t)put;
+        mio_iov_advance(&cur, &cnt, (size_t)put);
+    }
+    mio_wconsume(m, pending);
+    m->pos += size;
+    
+    DPRINT("Wrote %d bytes from %d segments\n", size, iovcnt);
+    return size;
+}
+
+// Flush write buffer to file
+int myflush(MIO *m) {
+    if (!m) {
+        DPRINT("Invalid MIO pointer to myflush\n");
+        return -1;
+    }
+    
+    if (!M_ISMW(m->rw)) {
+        DPRINT("File opened for reading, nothing to flush\n");
+        return 0;
+    }
+    
+    if (m->flags & MIO_MEM) {
+        DPRINT("Memory stream, data is already in place\n");
+        if (m->flags & MIO_GROW) {
+            mio_mempublish(m);
+        }
+        return 0;
+    }
+    
+    if (m->flags & MIO_PARALLEL) {
+        // submit what is pending, then wait until every frame is written
+        int submitted = m->ws > 0 ? mio_workers_submit(m) : 0;
+        if (submitted < 0 || mio_workers_drain(m, m->fs->wk->submitted) < 0) {
+            DPRINT("Parallel flush failed\n");
+            return -1;
+        }
+        return submitted;
+    }
+    
+    if (m->ws == 0) {
+        DPRINT("Write buffer is empty, nothing to flush\n");
+        return 0;
+    }
+    
+    if (m->flags & MIO_DIRECT) {
+        ssize_t flushed = mio_flush_direct(m, 1);
+        return flushed > INT_MAX ? INT_MAX : (int)flushed;
+    }
+    
+    if (m->flags & MIO_FILTER) {
+        return mio_filter_flush(m);
+    }
+    
+    // Write the whole ring (one or two segments), continuing after short
+    // writes; a partial write only advances the head, nothing is moved
+    size_t done = 0;
+    while (m->ws > 0) {
+        struct iovec v[2];
+        int cnt = mio_wsegs(m, v);
+        ssize_t written = mio_syswritev(m, v, cnt);
+        if (written < 0) {
+            int blocked = (errno == EAGAIN || errno == EWOULDBLOCK);
+            if (!blocked) {
+                DPRINT("Write error during flush: %s\n", strerror(errno));
+            }
+            return blocked ? MIO_WOULDBLOCK : -1;
+        }
+        if ((size_t)written < m->ws) {
+            DPRINT("Partial write during flush: %zd of %zu bytes\n", written, m->ws);
+        }
+        if (m->flags & MIO_DIGEST) {
+            mio_digest_iov(m->dg, v, (size_t)written);
+        }
+        mio_wconsume(m, (size_t)written);
+        done += (size_t)written;
+    }
+    
+    // Reset write position after successful flush
+    m->wh = 0;
+    m->wsince = 0;
+    DPRINT("Successfully flushed %zu bytes to file\n", done);
+    // the count saturates for write buffers over 2 GB
+    return done > INT_MAX ? INT_MAX : (int)done;
+}
+
+// Write single character to file
+int myputc(MIO *m, const char c) {
+    if (!m) {
+        DPRINT("Invalid MIO pointer to myputc\n");
+        return -1;
+    }
+    
+    // Use mywrite to write one character
+    int result = mywrite(m, &c, 1);
+    if (result == 1) {
+        DPRINT("Wrote character: %c\n", c);
+    } else {
+        DPRINT("Failed to write character\n");
+    }
+    return result;
+}
+
+// Write string to file; any length up to SSIZE_MAX in one call
+ssize_t myputs64(MIO *m, const char *str, size_t len) {
+    if (!m || !str || len > SSIZE_MAX) {
+        DPRINT("Invalid parameters to myputs64\n");
+        return -1;
+    }
+    
+    // Use mywrite64 to write the entire string
+    ssize_t result = mywrite64(m, str, len);
+    if (result == (ssize_t)len) {
+        DPRINT("Successfully wrote string of length %zu\n", len);
+    } else {
+        DPRINT("Failed to write complete string: %zd of %zu bytes\n", result, len);
+    }
+    return result;
+}
+
+// Write string to file
+int myputs(MIO *m, const char *str, const int len) {
+    if (len < 0) {
+        DPRINT("Invalid parameters to myputs\n");
+        return -1;
+    }
+    return (int)myputs64(m, str, (size_t)len);
+}
+
+// Current stream position: offset of the next byte read or written
+off_t mytell(MIO *m) {
+    if (!m) {
+        DPRINT("Invalid MIO pointer to mytell\n");
+        return -1;
+    }
+    return m->pos;
+}
+
+// Block of an indexed container holding raw offset 'target' (nblk past the end)
+static size_t mio_index_find(struct mio_fstack *fs, off_t target) {
+    size_t lo = 0, hi = fs->nblk;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (fs->blk[mid].rawoff + (off_t)fs->blk[mid].rawlen <= target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Position an indexed reader at the start of a block, dropping the buffered
+// data; returns the raw offset of the block or -1
+static off_t mio_index_seek(MIO *m, size_t block) {
+    struct mio_fstack *fs = m->fs;
+    off_t at = block < fs->nblk ? fs->blk[block].offset :
+               fs->nblk ? fs->blk[fs->nblk - 1].offset + MIO_FRAME_HDR + (off_t)fs->blk[fs->nblk - 1].enclen : 8;
+    if (lseek(m->fd, at, SEEK_SET) < 0) {
+        return -1;
+    }
+    fs->blknext = block;
+    fs->xs = fs->xe = 0;
+    m->rs = m->re = 0;
+    m->pos = block < fs->nblk ? fs->blk[block].rawoff :
+             fs->nblk ? fs->blk[fs->nblk - 1].rawoff + (off_t)fs->blk[fs->nblk - 1].rawlen : 0;
+    return m->pos;
+}
+
+// Move the stream position, lseek() style; returns the new position. Readers
+// keep their buffer when the target lies inside it, writers flush first.
+// Append, direct write and memory write handles cannot be repositioned.
+off_t myseek(MIO *m, off_t offset, int whence) {
+    if (!m || (whence != SEEK_SET && whence != SEEK_CUR && whence != SEEK_END)) {
+        DPRINT("Invalid parameters to myseek\n");
+        errno = EINVAL;
+        return -1;
+    }
+    
+    if (whence == SEEK_CUR && offset == 0) {
+        return m->pos;
+    }
+    
+    if (m->rw != MODE_R) {
+        if (m->rw == MODE_WA || (m->flags & (MIO_MEM | MIO_DIRECT | MIO_FILTER))) {
+            DPRINT("Write position of this handle is fixed\n");
+            errno = EINVAL;
+            return -1;
+        }
+        if (myflush(m) < 0) {
+            DPRINT("Failed to flush buffer before seek\n");
+            return -1;
+        }
+        m->wres = 0;
+        off_t at = lseek(m->fd, offset, whence);
+        if (at < 0) {
+            DPRINT("Seek failed: %s\n", strerror(errno));
+            return -1;
+        }
+        m->pos = at;
+        return at;
+    }
+    
+    m->spillneed = 0;  // a partly read record is abandoned
+    off_t target;
+    if (whence == SEEK_END) {
+        struct stat st;
+        if (m->flags & MIO_MEM) {
+            st.st_size = (off_t)m->rsize;
+        } else if (m->flags & MIO_INDEXED) {
+            struct mio_fstack *fs = m->fs;
+            st.st_size = fs->nblk ? fs->blk[fs->nblk - 1].rawoff + (off_t)fs->blk[fs->nblk - 1].rawlen : 0;
+        } else if (fstat(m->fd, &st) < 0) {
+            DPRINT("fstat failed: %s\n", strerror(errno));
+            return -1;
+        }
+        target = st.st_size + offset;
+    } else {
+        target = (whence == SEEK_SET) ? offset : m->pos + offset;
+    }
+    
+    // Targets inside the buffered window only move the cursor; for memory
+    // streams the window is the whole region
+    off_t start = m->pos - (off_t)m->rs;
+    if (target >= start && target <= m->pos + (off_t)(m->re - m->rs)) {
+        m->rs = (size_t)(target - start);
+        m->pos = target;
+        return target;
+    }
+    if (target < 0 || ((m->flags & (MIO_MEM | MIO_FILTER)) && !(m->flags & MIO_INDEXED))) {
+        DPRINT("Seek target %lld out of range\n", (long long)target);
+        errno = EINVAL;
+        return -1;
+    }
+    
+    // O_DIRECT reads restart at the aligned block holding the target, and
+    // indexed containers at the frame holding it
+    off_t base = (m->flags & MIO_DIRECT) ? target - target % (off_t)m->dalign : target;
+    if (m->flags & MIO_INDEXED) {
+        base = mio_index_seek(m, mio_index_find(m->fs, target));
+    } else if (lseek(m->fd, base, SEEK_SET) < 0) {
+        base = -1;
+    }
+    if (base < 0) {
+        DPRINT("Seek failed: %s\n", strerror(errno));
+        return -1;
+    }
+    m->rs = m->re = 0;
+    m->pos = base;
+    if (base < target) {
+        if (mio_refill(m) < 0) {
+            return -1;
+        }
+        size_t skip = (size_t)(target - base);
+        m->rs = skip < m->re ? skip : m->re;
+        m->pos = base + (off_t)m->rs;
+    }
+    DPRINT("Seeked to offset %lld\n", (long long)m->pos);
+    return m->pos;
+}
+
+// Switch a descriptor-backed handle in or out of non-blocking mode. In this
+// mode reads and writes return MIO_WOULDBLOCK instead of waiting for the fd.
+int mysetnonblock(MIO *m, int on) {
+    if (!m || m->fd < 0 || (on && (m->flags & MIO_FILTER))) {
+        DPRINT("Invalid MIO pointer to mysetnonblock\n");
+        return -1;
+    }
     
-    // Initialize MIO structure to zero
-    memset(mio, 0, sizeof(MIO));
-    mio->fd = -1;  // Mark as invalid initially
+    int fl = fcntl(m->fd, F_GETFL);
+    if (fl < 0 || fcntl(m->fd, F_SETFL, on ? fl | O_NONBLOCK : fl & ~O_NONBLOCK) < 0) {
+        DPRINT("Failed to change O_NONBLOCK: %s\n", strerror(errno));
+        return -1;
+    }
+    if (on) {
+        m->flags |= MIO_NONBLOCK;
+    } else {
+        m->flags &= ~MIO_NONBLOCK;
+    }
+    return 0;
+}
+
+// Descriptor to register with poll/epoll (-1 for memory streams); follow
+// handles give their inotify descriptor, which turns readable as the file changes
+int myfileno(MIO *m) {
+    if (m && (m->flags & MIO_FOLLOW)) {
+        return m->ifd;
+    }
+    return m ? m->fd : -1;
+}
+
+// Events the handle is waiting for: MIO_WANT_READ for readers, MIO_WANT_WRITE
+// while the write buffer holds data that could not be flushed yet
+int myinterest(MIO *m) {
+    if (!m || m->fd < 0) {
+        return 0;
+    }
+    if (m->rw == MODE_R) {
+        return MIO_WANT_READ;
+    }
+    return m->ws > 0 ? MIO_WANT_WRITE : 0;
+}
+
+// Continue flushing after the descriptor became writable. Returns 0 once the
+// write buffer is empty, MIO_WOULDBLOCK while data is still pending, -1 on error.
+int mydrive(MIO *m) {
+    if (!m) {
+        DPRINT("Invalid MIO pointer to mydrive\n");
+        return -1;
+    }
     
-    int flags = 0;
-    int create_mode = 0644;  // Default file permissions
+    if (!M_ISMW(m->rw) || m->ws == 0) {
+        return 0;
+    }
+    int flushed = myflush(m);
+    return flushed < 0 ? flushed : 0;
+}
+
+// Set how long reads at the end of a MODE_FOLLOW file wait for new data:
+// -1 - until it arrives (default), 0 - not at all, else milliseconds. When
+// the wait ends without data the read returns MIO_WOULDBLOCK.
+int mysetfollow(MIO *m, int timeout_ms) {
+    if (!m || !(m->flags & MIO_FOLLOW) || timeout_ms < -1) {
+        DPRINT("Invalid parameters to mysetfollow\n");
+        errno = EINVAL;
+        return -1;
+    }
+    m->ftimeout = timeout_ms;
+    return 0;
+}
+
+// Select the buffering policy (MIO_FULLBUF, MIO_LINEBUF, MIO_NOBUF or
+// MIO_TIMEBUF) and, when size is non-zero, the size of the buffer in use.
+// Resizing keeps buffered data; memory and direct streams keep their buffers.
+int mysetvbuf(MIO *m, int mode, size_t size) {
+    if (!m || mode < MIO_FULLBUF || mode > MIO_TIMEBUF || size > SSIZE_MAX) {
+        DPRINT("Invalid parameters to mysetvbuf\n");
+        return -1;
+    }
     
-    // Set flags based on requested mode
-    switch (mode) {
-        case MODE_R:
-            flags = O_RDONLY;
+    if (size > 0) {
+        if (m->flags & (MIO_MEM | MIO_DIRECT | MIO_FILTER)) {
+            DPRINT("Buffer size of memory, direct and filtered streams is fixed\n");
+            errno = EINVAL;
+            return -1;
+        }
+        int resized = (m->rw == MODE_R) ? mio_resize_rb(m, size) : mio_resize_wb(m, size);
+        if (resized < 0) {
+            return -1;
+        }
+    }
+    m->bufmode = mode;
+    m->wsince = 0;
+    DPRINT("Buffering mode %d, buffer size %zu\n", mode, size);
+    return 0;
+}
+
+// Bound how long written data may sit in wb before it is flushed. The bound
+// is checked on every write and by mytick(); selects MIO_TIMEBUF.
+int mysetlatency(MIO *m, long usec) {
+    if (!m || usec < 0) {
+        DPRINT("Invalid parameters to mysetlatency\n");
+        return -1;
+    }
+    m->maxdelay = usec;
+    return mysetvbuf(m, MIO_TIMEBUF, 0);
+}
+
+// Timer hook for MIO_TIMEBUF handles: flush if the oldest buffered byte is
+// older than the latency bound. Returns 1 if a flush was issued, 0 if not.
+int mytick(MIO *m) {
+    if (!m) {
+        DPRINT("Invalid MIO pointer to mytick\n");
+        return -1;
+    }
+    
+    if (m->bufmode != MIO_TIMEBUF || !M_ISMW(m->rw) || m->ws == 0 || m->wsince == 0 ||
+        mio_now_us() - m->wsince < m->maxdelay) {
+        return 0;
+    }
+    int flushed = myflush(m);
+    return (flushed < 0 && flushed != MIO_WOULDBLOCK) ? -1 : 1;
+}
+
+// Compute digests (MIO_DIGEST_CRC32C and/or MIO_DIGEST_XXH64, 0 - stop) over
+// the bytes read from or written to the file from now on. Memory streams and
+// direct writers, whose tail block is rewritten, are not supported.
+int mysetdigest(MIO *m, int which) {
+    if (!m || (which & ~(MIO_DIGEST_CRC32C | MIO_DIGEST_XXH64)) || (m->flags & MIO_MEM) ||
+        ((m->flags & MIO_DIRECT) && M_ISMW(m->rw))) {
+        DPRINT("Invalid parameters to mysetdigest\n");
+        errno = EINVAL;
+        return -1;
+    }
+    
+    if (which == 0) {
+        free(m->dg);
+        m->dg = NULL;
+        m->flags &= ~MIO_DIGEST;
+        return 0;
+    }
+    if (!m->dg && !(m->dg = malloc(sizeof(struct mio_digest)))) {
+        DPRINT("Failed to allocate digest state\n");
+        return -1;
+    }
+    pthread_once(&mio_crc_once, mio_crc_init);
+    m->dg->which = which;
+    m->dg->crc = 0xFFFFFFFF;
+    mio_xxh_reset(m->dg);
+    m->flags |= MIO_DIGEST;
+    return 0;
+}
+
+// Current digests (either pointer may be NULL). Readers cover every byte read
+// from the file so far, read-ahead included; writers cover every byte written,
+// including data still waiting in wb. Filtered handles digest the raw stream
+// (what mywrite() took and myread() returns), never the encoded frames, so
+// the result does not depend on when flushes happen.
+int mydigest(MIO *m, uint32_t *crc32c, uint64_t *xxh64) {
+    if (!m || !(m->flags & MIO_DIGEST)) {
+        DPRINT("No digest selected on this handle\n");
+        errno = EINVAL;
+        return -1;
+    }
+    
+    struct mio_digest d = *m->dg;
+    if (M_ISMW(m->rw) && m->ws > 0) {
+        struct iovec v[2];
+        mio_wsegs(m, v);
+        mio_digest_iov(&d, v, m->ws);
+    }
+    if (crc32c) {
+        *crc32c = d.crc ^ 0xFFFFFFFF;
+    }
+    if (xxh64) {
+        *xxh64 = mio_xxh_final(&d);
+    }
+    return 0;
+}
+
+// Push a filter onto the handle. Writes are encoded by the filters in push
+// order and written as frames {rawlen, enclen} + data on every flush; reads
+// decode the frames in reverse order. Filters go on before the first read or
+// write; memory, direct, follow and non-blocking handles cannot be filtered.
+int mypushfilter(MIO *m, const struct mio_filter *f) {
+    if (!m || !f || !f->bound || !f->encode || !f->decode ||
+        (m->flags & (MIO_MEM | MIO_DIRECT | MIO_FOLLOW | MIO_NONBLOCK | MIO_PARALLEL))) {
+        DPRINT("Invalid parameters to mypushfilter\n");
+        errno = EINVAL;
+        return -1;
+    }
+    if (m->re > 0 || m->ws > 0 || (m->fs && m->fs->xs < m->fs->xe) ||
+        (m->fs && m->fs->n == MIO_FILTER_MAX)) {
+        DPRINT("Filters must be pushed before any data is buffered\n");
+        errno = EINVAL;
+        return -1;
+    }
+    
+    if (m->flags & MIO_INDEXED) {
+        // containers record the stack by name; readers must match it
+        struct mio_fstack *fs = m->fs;
+        if (m->rw == MODE_R ? fs->n >= fs->ncodec || strncmp(f->name, fs->codec[fs->n], MIO_INDEX_NAME) != 0 :
+                              strlen(f->name) > MIO_INDEX_NAME) {
+            DPRINT("Filter '%s' does not match the container\n", f->name);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    
+    if (!m->fs && mio_filter_setup(m) < 0) {
+        return -1;
+    }
+    m->fs->f[m->fs->n++] = f;
+    if ((m->flags & MIO_INDEXED) && m->rw == MODE_R) {
+        mio_index_codecs(m);
+    }
+    DPRINT("Pushed filter '%s'\n", f->name);
+    return 0;
+}
+
+// Compress the frames of a filtered writer on 'nthreads' worker threads.
+// Frames are still written in order, by the thread calling mywrite() and
+// myflush(); the filters' encode callbacks must be safe to run concurrently.
+int mysetworkers(MIO *m, int nthreads) {
+    if (!m || !(m->flags & MIO_FILTER) || m->rw == MODE_R ||
+        nthreads < 1 || nthreads > MIO_WORKERS_MAX) {
+        DPRINT("Invalid parameters to mysetworkers\n");
+        errno = EINVAL;
+        return -1;
+    }
+    if (m->flags & MIO_PARALLEL) {
+        DPRINT("Workers already running\n");
+        errno = EINVAL;
+        return -1;
+    }
+    
+    struct mio_workers *wk = calloc(1, sizeof(struct mio_workers));
+    if (!wk) {
+        DPRINT("Failed to allocate worker pool\n");
+        return -1;
+    }
+    pthread_mutex_init(&wk->lock, NULL);
+    pthread_cond_init(&wk->work, NULL);
+    pthread_cond_init(&wk->done, NULL);
+    wk->fs = m->fs;
+    wk->count = (m->flags & MIO_INDEXED) != 0;
+    wk->fxcap = mio_filter_bound(m->fs, MIO_FILTER_BSIZE);
+    // two jobs per thread keep the workers busy while frames are written
+    wk->njobs = 2 * nthreads;
+    wk->jobs = calloc((size_t)wk->njobs, sizeof(struct mio_job));
+    wk->threads = calloc((size_t)nthreads, sizeof(pthread_t));
+    int ok = wk->jobs && wk->threads;
+    for (int i = 0; ok && i < wk->njobs; i++) {
+        wk->jobs[i].raw = malloc(MIO_FILTER_BSIZE);
+        wk->jobs[i].fx[0] = malloc(wk->fxcap);
+        wk->jobs[i].fx[1] = malloc(wk->fxcap);
+        ok = wk->jobs[i].raw && wk->jobs[i].fx[0] && wk->jobs[i].fx[1];
+    }
+    while (ok && wk->nthreads < nthreads) {
+        ok = pthread_create(&wk->threads[wk->nthreads], NULL, mio_worker_main, wk) == 0;
+        wk->nthreads += ok;
+    }
+    if (!ok) {
+        DPRINT("Failed to start %d compression workers\n", nthreads);
+        if (!wk->jobs) {
+            wk->njobs = 0;
+        }
+        mio_workers_free(wk);
+        errno = ENOMEM;
+        return -1;
+    }
+    
+    m->fs->wk = wk;
+    m->flags |= MIO_PARALLEL;
+    DPRINT("Started %d compression workers\n", nthreads);
+    return 0;
+}
+
+// Blocks in an indexed container (0 for other handles); writers count the
+// blocks written so far
+size_t mynblocks(MIO *m) {
+    return (m && (m->flags & MIO_INDEXED)) ? m->fs->nblk : 0;
+}
+
+// Offsets, sizes and line count of one block of an indexed container
+int myblockinfo(MIO *m, size_t block, struct mio_block *info) {
+    if (!m || !info || !(m->flags & MIO_INDEXED) || block >= m->fs->nblk) {
+        DPRINT("Invalid parameters to myblockinfo\n");
+        errno = EINVAL;
+        return -1;
+    }
+    *info = m->fs->blk[block];
+    return 0;
+}
+
+// Continue reading an indexed container at the start of 'block' (block
+// count: end of data); returns the raw offset of the block
+off_t myseekblock(MIO *m, size_t block) {
+    if (!m || m->rw != MODE_R || !(m->flags & MIO_INDEXED) || block > m->fs->nblk) {
+        DPRINT("Invalid parameters to myseekblock\n");
+        errno = EINVAL;
+        return -1;
+    }
+    off_t at = mio_index_seek(m, block);
+    if (at < 0) {
+        DPRINT("Seek failed: %s\n", strerror(errno));
+    }
+    return at;
+}
+
+// Decode one block of an indexed container into dst without touching the
+// handle's buffers or position. Safe to call from several threads at once
+// (with filters whose decode is), so blocks can be decoded in parallel.
+ssize_t mypreadblock(MIO *m, size_t block, char *dst, size_t cap) {
+    if (!m || !dst || m->rw != MODE_R || !(m->flags & MIO_INDEXED) || block >= m->fs->nblk) {
+        DPRINT("Invalid parameters to mypreadblock\n");
+        errno = EINVAL;
+        return -1;
+    }
+    struct mio_fstack *fs = m->fs;
+    const struct mio_block *b = &fs->blk[block];
+    if (fs->n < fs->ncodec) {
+        DPRINT("Container filter '%.16s' was not pushed\n", fs->codec[fs->n]);
+        errno = EINVAL;
+        return -1;
+    }
+    if (cap < b->rawlen) {
+        DPRINT("Block %zu needs %zu bytes\n", block, b->rawlen);
+        errno = ERANGE;
+        return -1;
+    }
+    
+    size_t fxcap = mio_filter_bound(fs, b->rawlen);
+    fxcap = fxcap > b->enclen ? fxcap : b->enclen;
+    char *frame = malloc(MIO_FRAME_HDR + fxcap);
+    char *fx[2] = { frame ? frame + MIO_FRAME_HDR : NULL, malloc(fxcap) };
+    ssize_t result = -1;
+    if (!frame || !fx[1]) {
+        DPRINT("Failed to allocate block buffers\n");
+    } else if (pread(m->fd, frame, MIO_FRAME_HDR + b->enclen, b->offset) !=
+               (ssize_t)(MIO_FRAME_HDR + b->enclen) ||
+               mio_le32((unsigned char *)frame) != b->rawlen ||
+               mio_le32((unsigned char *)frame + 4) != b->enclen) {
+        DPRINT("Block %zu does not match the index\n", block);
+        errno = EBADMSG;
+    } else if (mio_filter_decode(fs, fx, fxcap, b->enclen, dst, b->rawlen) == 0) {
+        result = (ssize_t)b->rawlen;
+    }
+    free(frame);
+    free(fx[1]);
+    return result;
+}
+
+// Records are a varint (LEB128) length, the payload and, with
+// mysetrecordcrc() on, the payload's CRC32C (32-bit little-endian). Both
+// sides of a stream must agree on the CRC setting.
+int mysetrecordcrc(MIO *m, int on) {
+    if (!m) {
+        DPRINT("Invalid MIO pointer to mysetrecordcrc\n");
+        return -1;
+    }
+    if (on) {
+        pthread_once(&mio_crc_once, mio_crc_init);
+        m->flags |= MIO_RECCRC;
+    } else {
+        m->flags &= ~MIO_RECCRC;
+    }
+    return 0;
+}
+
+// Write one length-prefixed record; returns len or -1. Non-blocking handles
+// are not supported, a partial record would corrupt the stream.
+ssize_t mywriterecord(MIO *m, const void *data, size_t len) {
+    if (!m || (!data && len > 0) || len > SSIZE_MAX || (m->flags & MIO_NONBLOCK)) {
+        DPRINT("Invalid parameters to mywriterecord\n");
+        errno = EINVAL;
+        return -1;
+    }
+    
+    unsigned char hdr[MIO_VARINT_MAX];
+    size_t hlen = 0;
+    for (uint64_t v = len; ; v >>= 7) {
+        hdr[hlen++] = (unsigned char)((v & 0x7f) | (v >= 0x80 ? 0x80 : 0));
+        if (v < 0x80) {
             break;
-        case MODE_WA:
-            flags = O_WRONLY | O_CREAT | O_APPEND;
+        }
+    }
+    if (mywrite64(m, (const char *)hdr, hlen) != (ssize_t)hlen ||
+        (len > 0 && mywrite64(m, data, len) != (ssize_t)len)) {
+        DPRINT("Failed to write record of %zu bytes\n", len);
+        return -1;
+    }
+    if (m->flags & MIO_RECCRC) {
+        unsigned char crc[4];
+        mio_put32le(crc, mio_crc_update(0xFFFFFFFF, data, len) ^ 0xFFFFFFFF);
+        if (mywrite64(m, (const char *)crc, sizeof(crc)) != (ssize_t)sizeof(crc)) {
+            DPRINT("Failed to write record checksum\n");
+            return -1;
+        }
+    }
+    return (ssize_t)len;
+}
+
+// Read the next record. *ptr points into rb when the record fits in the
+// buffer, else into a scratch buffer reused by later calls; either way it is
+// valid until the next read from the handle. Returns 1, 0 at end of file, -1
+// on errors (EBADMSG: truncated or corrupt record) or MIO_WOULDBLOCK. After
+// MIO_WOULDBLOCK nothing is lost: call again, without other reads in between,
+// once more data has arrived.
+int myreadrecord(MIO *m, const void **ptr, size_t *len) {
+    if (!m || !ptr || !len || m->rw != MODE_R) {
+        DPRINT("Invalid parameters to myreadrecord\n");
+        errno = EINVAL;
+        return -1;
+    }
+    
+    size_t tlen = (m->flags & MIO_RECCRC) ? 4 : 0;
+    if (m->spillneed) {
+        goto spill;  // resume a large record
+    }
+    // Decode the length from the buffered bytes, reading more only while it
+    // continues past them; a short record must not wait for more input
+    ssize_t have;
+    uint64_t size = 0;
+    size_t hlen = 0;
+    for (;;) {
+        if (hlen == m->re - m->rs) {
+            have = mio_fill(m, hlen + 1);
+            if (have < 0) {
+                return (int)have;
+            }
+            if ((size_t)have == hlen) {
+                if (hlen == 0) {
+                    return 0;
+                }
+                DPRINT("Truncated record length\n");
+                errno = EBADMSG;
+                return -1;
+            }
+        }
+        if (hlen == MIO_VARINT_MAX) {
+            DPRINT("Invalid record length\n");
+            errno = EBADMSG;
+            return -1;
+        }
+        unsigned char c = (unsigned char)m->rb[m->rs + hlen++];
+        size |= (uint64_t)(c & 0x7f) << (7 * (hlen - 1));
+        if (!(c & 0x80)) {
             break;
-        case MODE_WT:
-            flags = O_WRONLY | O_CREAT | O_TRUNC;
+        }
+    }
+    if (size > SSIZE_MAX - hlen - tlen) {
+        DPRINT("Record length %llu out of range\n", (unsigned long long)size);
+        errno = EBADMSG;
+        return -1;
+    }
+    
+    const char *data;
+    size_t total = hlen + (size_t)size + tlen;
+    size_t need = (size_t)size + tlen;
+    if (total <= m->rsize) {
+        // the whole record fits: hand out a view into rb
+        have = mio_fill(m, total);
+        if (have < 0) {
+            return (int)have;
+        }
+        if ((size_t)have < total) {
+            DPRINT("Truncated record\n");
+            errno = EBADMSG;
+            return -1;
+        }
+        data = m->rb + m->rs + hlen;
+        m->rs += total;
+        m->pos += (off_t)total;
+    } else {
+        if (need > m->spillcap) {
+            char *spill = realloc(m->spill, need);
+            if (!spill) {
+                DPRINT("Failed to allocate %zu byte record buffer\n", need);
+                return -1;
+            }
+            m->spill = spill;
+            m->spillcap = need;
+        }
+        m->rs += hlen;
+        m->pos += (off_t)hlen;
+        m->spillhave = 0;
+        m->spillneed = need;
+        
+    spill:
+        // the payload may arrive over several calls
+        while (m->spillhave < m->spillneed) {
+            ssize_t got = myread64(m, m->spill + m->spillhave, m->spillneed - m->spillhave);
+            if (got == MIO_WOULDBLOCK) {
+                return MIO_WOULDBLOCK;
+            }
+            if (got <= 0) {
+                m->spillneed = 0;
+                DPRINT("Truncated record\n");
+                errno = EBADMSG;
+                return -1;
+            }
+            m->spillhave += (size_t)got;
+        }
+        need = m->spillneed;
+        size = need - tlen;
+        m->spillneed = 0;
+        data = m->spill;
+    }
+    
+    if (tlen && mio_crc_update(0xFFFFFFFF, (const unsigned char *)data, (size_t)size) !=
+                    (mio_le32((const unsigned char *)data + size) ^ 0xFFFFFFFF)) {
+        DPRINT("Record checksum mismatch\n");
+        errno = EBADMSG;
+        return -1;
+    }
+    *ptr = data;
+    *len = (size_t)size;
+    return 1;
+}
+
+// Look at the next n bytes without consuming them: at least n unread bytes
+// are made contiguous in rb (fewer only at end of file) and *p points at
+// them. Returns the bytes available there (at most n), -1 or MIO_WOULDBLOCK.
+ssize_t mypeek(MIO *m, size_t n, const char **p) {
+    if (!m || !p || m->rw != MODE_R || n > SSIZE_MAX) {
+        DPRINT("Invalid parameters to mypeek\n");
+        errno = EINVAL;
+        return -1;
+    }
+    ssize_t have = mio_fill(m, n);
+    if (have < 0) {
+        return have;
+    }
+    *p = m->rb + m->rs;
+    return (size_t)have < n ? have : (ssize_t)n;
+}
+
+// Push one byte back so the next read returns it first; any number of bytes
+// can be pushed back. Memory streams only take back the bytes they returned,
+// and direct handles only as far as the start of rb.
+int myungetc(MIO *m, char c) {
+    if (!m || m->rw != MODE_R || m->pos == 0) {
+        DPRINT("Invalid parameters to myungetc\n");
+        errno = EINVAL;
+        return -1;
+    }
+    if (m->rs > 0 && (m->rb[m->rs - 1] == c || !(m->flags & MIO_MEM))) {
+        m->rb[--m->rs] = c;
+        m->pos--;
+        return 0;
+    }
+    if (m->flags & (MIO_MEM | MIO_DIRECT)) {
+        DPRINT("Cannot push back into this buffer\n");
+        errno = EINVAL;
+        return -1;
+    }
+    
+    // nothing consumed in rb: shift the unread bytes up by one
+    if (m->re == m->rsize && mio_resize_rb(m, 2 * m->rsize) < 0) {
+        return -1;
+    }
+    memmove(m->rb + 1, m->rb, m->re);
+    m->rb[0] = c;
+    m->re++;
+    m->pos--;
+    return 0;
+}
+
+// Consume up to n bytes without copying them. Seekable files jump over
+// what is not buffered; pipes and filtered streams read through it.
+// Returns the bytes skipped, fewer only at end of file or when a non-blocking
+// handle runs out of input, -1, or MIO_WOULDBLOCK if nothing could be skipped.
+ssize_t myskip(MIO *m, size_t n) {
+    if (!m || m->rw != MODE_R || n > SSIZE_MAX) {
+        DPRINT("Invalid parameters to myskip\n");
+        errno = EINVAL;
+        return -1;
+    }
+    
+    size_t done = m->re - m->rs < n ? m->re - m->rs : n;
+    m->rs += done;
+    m->pos += (off_t)done;
+    
+    struct stat st;
+    int seekable = !(m->flags & (MIO_MEM | MIO_FOLLOW)) &&
+                   (!(m->flags & MIO_FILTER) || (m->flags & MIO_INDEXED));
+    if (done < n && seekable && fstat(m->fd, &st) == 0 && (S_ISREG(st.st_mode) || (m->flags & MIO_INDEXED))) {
+        // stop at the end of the data, as reading would
+        off_t target = m->pos + (off_t)(n - done);
+        if (!(m->flags & MIO_INDEXED) && target > st.st_size) {
+            target = st.st_size > m->pos ? st.st_size : m->pos;
+        }
+        off_t from = m->pos;
+        if (myseek(m, target, SEEK_SET) < 0) {
+            return -1;
+        }
+        return (ssize_t)(done + (size_t)(m->pos - from));
+    }
+    
+    while (done < n) {
+        ssize_t got = mio_refill(m);
+        if (got < 0) {
+            return done > 0 ? (ssize_t)done : got;
+        }
+        if (got == 0) {
             break;
-        default:
-            DPRINT("Invalid mode specified: %d\n", mode);
-            free(mio);
-            return NULL;
+        }
+        size_t take = m->re < n - done ? m->re : n - done;
+        m->rs = take;
+        m->pos += (off_t)take;
+        done += take;
+    }
+    return (ssize_t)done;
+}
+
+// Tokenize like mygets() (whitespace separated), but return up to max tokens
+// per call, copied NUL-terminated and back to back into the caller's arena.
+// A call refills only while it has no token yet; after that it stops at the
+// end of the buffered data so no token is split. Tokens are not truncated.
+// Returns the tokens stored, 0 at end of file, -1 (ENOBUFS: the first token
+// does not fit the arena; EINVAL: max is 0) or MIO_WOULDBLOCK.
+ssize_t mygets_batch(MIO *m, struct mio_token *out, size_t max, struct mio_arena *arena) {
+    if (!m || !out || !arena || max == 0 || m->rw != MODE_R || arena->used > arena->size) {
+        DPRINT("Invalid parameters to mygets_batch\n");
+        errno = EINVAL;
+        return -1;
     }
     
-    // Open the file using low-level system call
-    mio->fd = open(name, flags, create_mode);
-    if (mio->fd < 0) {
-        DPRINT("Failed to open file '%s': %s\n", name, strerror(errno));
-        free(mio);
+    size_t count = 0;
+    while (count < max) {
+        // skip whitespace, refilling only for the first token
+        while (m->rs < m->re && M_ISWS(m->rb[m->rs])) {
+            m->rs++;
+            m->pos++;
+        }
+        if (m->rs == m->re) {
+            if (count > 0) {
+                break;
+            }
+            ssize_t avail = mio_fill(m, 1);
+            if (avail <= 0) {
+                return avail;
+            }
+            continue;
+        }
+        
+        // find the end of the token; a token running into the end of the
+        // buffered data may continue in the file
+        size_t end = m->rs + 1, scanned;
+        for (;;) {
+            while (end < m->re && !M_ISWS(m->rb[end])) {
+                end++;
+            }
+            if (end < m->re) {
+                break;
+            }
+            if (count > 0) {
+                return (ssize_t)count;
+            }
+            scanned = end - m->rs;
+            ssize_t avail = mio_fill(m, scanned + 1);
+            if (avail < 0) {
+                return avail;
+            }
+            end = m->rs + scanned;
+            if ((size_t)avail <= scanned) {
+                break;  // end of file ends the token
+            }
+        }
+        
+        size_t len = end - m->rs;
+        if (len + 1 > arena->size - arena->used) {
+            if (count > 0) {
+                break;
+            }
+            DPRINT("Token of %zu bytes does not fit the arena\n", len);
+            errno = ENOBUFS;
+            return -1;
+        }
+        char *dst = arena->base + arena->used;
+        memcpy(dst, m->rb + m->rs, len);
+        dst[len] = '\0';
+        arena->used += len + 1;
+        out[count].ptr = dst;
+        out[count].len = len;
+        count++;
+        m->rs = end;
+        m->pos += (off_t)len;
+    }
+    return (ssize_t)count;
+}
+
+// CSV/TSV reader state. The buffered text is classified in 64-byte blocks
+// into bitmasks of quotes, delimiters and newlines (SSE2 compares where
+// available); a prefix XOR of the quote mask marks the bytes inside quotes,
+// and the delimiters and newlines outside quotes are queued as stream
+// offsets (offset << 1 | is-newline). Offsets survive compaction of rb,
+// since pos - rs is always the stream offset of rb[0].
+struct mio_csv {
+    MIO *m;
+    char delim;
+    uint64_t *idx;		// structural characters, idx[ihead..nidx) unused
+    size_t nidx, ihead, icap;
+    off_t scanned;		// stream offset classified up to
+    off_t cursor;		// where the last row ended (m->pos)
+    uint64_t inq;		// all ones while a quoted field continues
+    int *proj;			// column -> output slot + 1 (0 - skipped)
+    int nproj, projcols;	// output slots, entries in proj
+    struct mio_field *out;	// the row handed out
+    size_t outcap;
+    char *scratch;		// unescaped quoted fields
+    size_t scap;
+};
+
+// Bitmasks of quotes, delimiters and newlines in 64 bytes at p
+static void mio_csv_classify(const char *p, char delim, uint64_t *q, uint64_t *d, uint64_t *n) {
+#ifdef __SSE2__
+    const __m128i vq = _mm_set1_epi8('"'), vd = _mm_set1_epi8(delim), vn = _mm_set1_epi8('\n');
+    uint64_t qm = 0, dm = 0, nm = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+        qm |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vq)) << (16 * i);
+        dm |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vd)) << (16 * i);
+        nm |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vn)) << (16 * i);
+    }
+    *q = qm;
+    *d = dm;
+    *n = nm;
+#else
+    uint64_t qm = 0, dm = 0, nm = 0;
+    for (int i = 0; i < 64; i++) {
+        qm |= (uint64_t)(p[i] == '"') << i;
+        dm |= (uint64_t)(p[i] == delim) << i;
+        nm |= (uint64_t)(p[i] == '\n') << i;
+    }
+    *q = qm;
+    *d = dm;
+    *n = nm;
+#endif
+}
+
+// Classify len (at most 64) bytes at p, the bytes at stream offset 'at',
+// and queue their structural characters
+static int mio_csv_index(struct mio_csv *c, const char *p, size_t len, off_t at) {
+    char pad[64];
+    if (len < 64) {
+        memset(pad, 0, sizeof(pad));
+        memcpy(pad, p, len);
+        p = pad;
+    }
+    uint64_t q, d, n;
+    mio_csv_classify(p, c->delim, &q, &d, &n);
+    uint64_t valid = len < 64 ? ((uint64_t)1 << len) - 1 : ~(uint64_t)0;
+    
+    // prefix XOR: bit i is set when an odd number of quotes precede it
+    q &= valid;
+    q ^= q << 1;
+    q ^= q << 2;
+    q ^= q << 4;
+    q ^= q << 8;
+    q ^= q << 16;
+    q ^= q << 32;
+    uint64_t inside = q ^ c->inq;
+    c->inq = (uint64_t)0 - (inside >> (len - 1) & 1);
+    uint64_t st = (d | n) & ~inside & valid;
+    
+    size_t count = (size_t)__builtin_popcountll(st);
+    if (c->nidx + count > c->icap) {
+        if (c->ihead > 0) {
+            memmove(c->idx, c->idx + c->ihead, (c->nidx - c->ihead) * sizeof(uint64_t));
+            c->nidx -= c->ihead;
+            c->ihead = 0;
+        }
+        if (c->nidx + count > c->icap) {
+            size_t cap = 2 * c->icap + count;
+            uint64_t *idx = realloc(c->idx, cap * sizeof(uint64_t));
+            if (!idx) {
+                DPRINT("Failed to grow CSV index\n");
+                return -1;
+            }
+            c->idx = idx;
+            c->icap = cap;
+        }
+    }
+    while (st) {
+        int bit = __builtin_ctzll(st);
+        c->idx[c->nidx++] = (uint64_t)(at + bit) << 1 | (n >> bit & 1);
+        st &= st - 1;
+    }
+    return 0;
+}
+
+// Start reading delimited text from m; delim is ',' for CSV, '\t' for TSV.
+// The handle stays owned by the caller, who should not read from it directly
+// while rows are being read.
+struct mio_csv *mycsv_open(MIO *m, char delim) {
+    if (!m || m->rw != MODE_R || delim == '"' || delim == '\n') {
+        DPRINT("Invalid parameters to mycsv_open\n");
+        errno = EINVAL;
+        return NULL;
+    }
+    struct mio_csv *c = calloc(1, sizeof(struct mio_csv));
+    if (!c) {
+        DPRINT("Failed to allocate CSV reader\n");
         return NULL;
     }
-    
-    // Allocate read and write buffers
-    mio->rb = malloc(MBSIZE);
-    mio->wb = malloc(MBSIZE);
-    if (!mio->rb || !mio->wb) {
-        DPRINT("Failed to allocate buffers\n");
-        if (mio->rb) free(mio->rb);
-        if (mio->wb) free(mio->wb);
-        close(mio->fd);
-        free(mio);
-        return NULL;
+    c->m = m;
+    c->delim = delim;
+    c->scanned = c->cursor = m->pos;
+    return c;
+}
+
+// Return only the given columns (0-based), in the order listed; columns a
+// row does not have come back as {NULL, 0}. ncols 0 returns every column.
+int mycsv_project(struct mio_csv *c, const int *cols, int ncols) {
+    if (!c || ncols < 0 || (ncols > 0 && !cols)) {
+        DPRINT("Invalid parameters to mycsv_project\n");
+        errno = EINVAL;
+        return -1;
+    }
+    int most = -1;
+    for (int i = 0; i < ncols; i++) {
+        if (cols[i] < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        most = cols[i] > most ? cols[i] : most;
+    }
+    int *proj = NULL;
+    if (ncols > 0 && !(proj = calloc((size_t)most + 1, sizeof(int)))) {
+        DPRINT("Failed to allocate projection\n");
+        return -1;
+    }
+    for (int i = 0; i < ncols; i++) {
+        proj[cols[i]] = i + 1;
+    }
+    free(c->proj);
+    c->proj = proj;
+    c->nproj = ncols;
+    c->projcols = most + 1;
+    return 0;
+}
+
+// Store field 'col' of the row, [s, e) in rb, unquoting quoted fields
+static int mio_csv_field(struct mio_csv *c, size_t col, const char *s, const char *e, size_t *used) {
+    size_t slot = col;
+    if (c->proj) {
+        if (col >= (size_t)c->projcols || !c->proj[col]) {
+            return 0;  // projected away: never looked at
+        }
+        slot = (size_t)c->proj[col] - 1;
+    } else if (col >= c->outcap) {
+        size_t cap = c->outcap ? 2 * c->outcap : 16;
+        struct mio_field *out = realloc(c->out, cap * sizeof(struct mio_field));
+        if (!out) {
+            DPRINT("Failed to grow CSV row\n");
+            return -1;
+        }
+        c->out = out;
+        c->outcap = cap;
     }
     
-    // Initialize MIO structure fields
-    mio->rw = mode;
-    mio->rsize = MBSIZE;
-    mio->wsize = MBSIZE;
-    mio->rs = 0;  // Read buffer start position
-    mio->re = 0;  // Read buffer end position (amount of valid data)
-    mio->ws = 0;  // Write buffer current position
-    mio->we = 0;  // Write buffer end position
-    
-    DPRINT("Successfully opened file '%s' in mode %d\n", name, mode);
-    return mio;
+    if (e - s >= 2 && *s == '"' && e[-1] == '"') {
+        s++;
+        e--;
+        const char *dq = memchr(s, '"', (size_t)(e - s));
+        if (dq) {
+            // "" stands for one quote: copy out without the escapes
+            char *dst = c->scratch + *used, *start = dst;
+            for (const char *p = s; p < e; p++) {
+                *dst++ = *p;
+                if (*p == '"' && p + 1 < e && p[1] == '"') {
+                    p++;
+                }
+            }
+            s = start;
+            e = dst;
+            *used += (size_t)(dst - start);
+        }
+    }
+    c->out[slot].ptr = s;
+    c->out[slot].len = (size_t)(e - s);
+    return 0;
 }
 
-// Close file and free resources
-int myclose(MIO *m) {
-    if (!m) {
-        DPRINT("Attempt to close NULL MIO pointer\n");
+// Read the next row and point *fields at its fields, which stay valid until
+// the next call. Quoted fields may hold delimiters, newlines and "" escapes.
+// Returns the number of fields (the projection size when projecting), 0 at
+// end of file, -1 (EBADMSG: a quote is still open at end of file) or
+// MIO_WOULDBLOCK.
+ssize_t mycsv_row(struct mio_csv *c, const struct mio_field **fields) {
+    if (!c || !fields) {
+        DPRINT("Invalid parameters to mycsv_row\n");
+        errno = EINVAL;
         return -1;
     }
+    MIO *m = c->m;
+    if (m->pos != c->cursor) {
+        // the handle was read or seeked directly: classify afresh
+        c->nidx = c->ihead = 0;
+        c->scanned = c->cursor = m->pos;
+        c->inq = 0;
+    }
     
-    int result = 0;
+    // find the newline ending the row, classifying more text as needed
+    size_t i = c->ihead;
+    int eof = 0;
+    for (;;) {
+        while (i < c->nidx && !(c->idx[i] & 1)) {
+            i++;
+        }
+        if (i < c->nidx || eof) {
+            break;
+        }
+        off_t base = m->pos - (off_t)m->rs;
+        size_t done = (size_t)(c->scanned - base);
+        if (m->re - done < 64) {
+            ssize_t avail = mio_fill(m, done - m->rs + 64);
+            if (avail < 0) {
+                return avail;
+            }
+            base = m->pos - (off_t)m->rs;
+            done = (size_t)(c->scanned - base);
+            eof = m->re - done < 64;
+        }
+        // classify whole blocks; a shorter tail only at end of file. The
+        // queue may be compacted, so i is kept relative to its head.
+        i -= c->ihead;
+        while (m->re - done >= 64 || (eof && done < m->re)) {
+            size_t len = m->re - done < 64 ? m->re - done : 64;
+            if (mio_csv_index(c, m->rb + done, len, c->scanned) < 0) {
+                return -1;
+            }
+            done += len;
+            c->scanned += (off_t)len;
+        }
+        i += c->ihead;
+    }
     
-    // If file was opened for writing, flush any remaining data
-    if (M_ISMW(m->rw) && m->ws > 0) {
-        DPRINT("Flushing write buffer before close\n");
-        if (myflush(m) < 0) {
-            DPRINT("Failed to flush buffer during close\n");
-            result = -1;
+    off_t base = m->pos - (off_t)m->rs;
+    size_t end;
+    if (i < c->nidx) {
+        end = (size_t)((off_t)(c->idx[i] >> 1) - base);
+    } else {
+        if (m->rs == m->re) {
+            return 0;
         }
+        if (c->inq) {
+            DPRINT("Quoted field not closed at end of file\n");
+            errno = EBADMSG;
+            return -1;
+        }
+        end = m->re;  // last row without a newline
+    }
+    size_t next = i < c->nidx ? end + 1 : end;
+    if (end > m->rs && m->rb[end - 1] == '\r') {
+        end--;
     }
     
-    // Close the file descriptor
-    if (close(m->fd) < 0) {
-        DPRINT("Failed to close file descriptor: %s\n", strerror(errno));
-        result = -1;
+    if (end - m->rs > c->scap) {
+        char *scratch = realloc(c->scratch, end - m->rs);
+        if (!scratch) {
+            DPRINT("Failed to grow CSV scratch\n");
+            return -1;
+        }
+        c->scratch = scratch;
+        c->scap = end - m->rs;
+    }
+    if ((size_t)c->nproj > c->outcap) {
+        struct mio_field *out = realloc(c->out, (size_t)c->nproj * sizeof(struct mio_field));
+        if (!out) {
+            DPRINT("Failed to grow CSV row\n");
+            return -1;
+        }
+        c->out = out;
+        c->outcap = (size_t)c->nproj;
+    }
+    for (int k = 0; k < c->nproj; k++) {
+        c->out[k].ptr = NULL;
+        c->out[k].len = 0;
     }
     
-    // Free buffers and MIO structure
-    if (m->rb) free(m->rb);
-    if (m->wb) free(m->wb);
-    free(m);
+    // split at the delimiters before the newline
+    size_t col = 0, used = 0;
+    const char *s = m->rb + m->rs;
+    for (size_t k = c->ihead; k < i; k++) {
+        const char *d = m->rb + ((off_t)(c->idx[k] >> 1) - base);
+        if (mio_csv_field(c, col++, s, d, &used) < 0) {
+            return -1;
+        }
+        s = d + 1;
+    }
+    if (mio_csv_field(c, col++, s, m->rb + (end > (size_t)(s - m->rb) ? end : (size_t)(s - m->rb)), &used) < 0) {
+        return -1;
+    }
     
-    DPRINT("File closed successfully\n");
-    return result;
+    c->ihead = i < c->nidx ? i + 1 : i;
+    m->pos += (off_t)(next - m->rs);
+    m->rs = next;
+    c->cursor = m->pos;
+    *fields = c->out;
+    return c->proj ? c->nproj : (ssize_t)col;
 }
 
-// Read data from file into buffer
-int myread(MIO *m, char *b, const int size) {
-    if (!m || !b || size < 0) {
-        DPRINT("Invalid parameters to myread\n");
-        return -1;
+// Free the reader; the MIO handle stays open
+void mycsv_close(struct mio_csv *c) {
+    if (!c) {
+        return;
     }
-    
-    if (m->rw != MODE_R) {
-        DPRINT("File not opened for reading\n");
+    free(c->idx);
+    free(c->proj);
+    free(c->out);
+    free(c->scratch);
+    free(c);
+}
+
+// Columnar numeric loader. Text is taken from rb in chunks of whole lines;
+// each chunk is split at newlines into one part per thread, and each part
+// is parsed into its own range of rows of the caller's arrays.
+struct mio_load_part {
+    const struct mio_column *cols;
+    int ncols;
+    char delim;
+    const char *b, *e;		// whole lines
+    size_t row0;		// row of the first line
+    size_t errors, first_row;
+    int first_col;
+};
+
+// 8 ASCII digits at p as a number, or -1 when they are not all digits.
+// Two multiplies combine the digits pairwise, then in fours, then in eights.
+static int64_t mio_swar8(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    if ((v & 0xF0F0F0F0F0F0F0F0ULL) != 0x3030303030303030ULL ||
+        ((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) != 0x3030303030303030ULL) {
         return -1;
     }
-    
-    int total_read = 0;
-    
-    while (total_read < size) {
-        // If read buffer is empty, refill it from file
-        if (m->rs >= m->re) {
-            m->re = read(m->fd, m->rb, m->rsize);
-            if (m->re < 0) {
-                DPRINT("Read error: %s\n", strerror(errno));
-                return -1;
-            }
-            if (m->re == 0) {
-                // End of file reached
-                DPRINT("EOF reached, read %d bytes\n", total_read);
-                return total_read > 0 ? total_read : -1;
-            }
-            m->rs = 0;
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+         (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return (int64_t)v;
+}
+
+// Accumulate the digits at *pp into *v, at most 'room' of them (the rest are
+// only counted); returns the number of digits
+static size_t mio_digits(const char **pp, const char *e, uint64_t *v, size_t room) {
+    const char *p = *pp;
+    size_t n = 0;
+    while (n + 8 <= room && e - p >= 8) {
+        int64_t eight = mio_swar8(p);
+        if (eight < 0) {
+            break;
         }
-        
-        // Calculate how many bytes we can copy from buffer
-        int available = m->re - m->rs;
-        int needed = size - total_read;
-        int to_copy = (available < needed) ? available : needed;
-        
-        // Copy data from read buffer to user buffer
-        memcpy(b + total_read, m->rb + m->rs, to_copy);
-        m->rs += to_copy;
-        total_read += to_copy;
+        *v = *v * 100000000 + (uint64_t)eight;
+        p += 8;
+        n += 8;
     }
-    
-    DPRINT("Read %d bytes from file\n", total_read);
-    return total_read;
+    for (; p < e && (unsigned)(*p - '0') < 10; p++, n++) {
+        if (n < room) {
+            *v = *v * 10 + (uint64_t)(*p - '0');
+        }
+    }
+    *pp = p;
+    return n;
 }
 
-// Read single character from file
-int mygetc(MIO *m, char *c) {
-    if (!m || !c) {
-        DPRINT("Invalid parameters to mygetc\n");
-        return -1;
+// Integer field at *pp; returns 0 and the value, -1 when there is no number
+// or it does not fit [lo, hi]
+static int mio_parse_int(const char **pp, const char *e, int64_t lo, int64_t hi, int64_t *out) {
+    const char *p = *pp;
+    while (p < e && *p == ' ') {
+        p++;
     }
-    
-    // Use myread to get one character
-    int result = myread(m, c, 1);
-    if (result == 1) {
-        DPRINT("Read character: %c\n", *c);
-    } else {
-        DPRINT("Failed to read character\n");
+    int neg = p < e && *p == '-';
+    if (p < e && (*p == '-' || *p == '+')) {
+        p++;
     }
-    return result;
+    uint64_t v = 0;
+    size_t n = mio_digits(&p, e, &v, 19);
+    *pp = p;
+    if (n == 0 || n > 19 || v > (uint64_t)hi + (uint64_t)neg) {
+        return -1;
+    }
+    *out = neg ? (int64_t)(0 - v) : (int64_t)v;
+    return !neg || *out >= lo ? 0 : -1;
 }
 
-// Read string until whitespace
-char *mygets(MIO *m, int *len) {
-    if (!m) {
-        DPRINT("Invalid MIO pointer to mygets\n");
-        return NULL;
+static const double mio_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Floating-point field at *pp. Clinger's fast path: a mantissa of at most
+// 2^53 times an exact power of ten up to 1e22 rounds correctly with one
+// multiply or divide. Anything else (long mantissas, large exponents, inf,
+// nan, hex) goes through strtod().
+static int mio_parse_double(const char **pp, const char *e, char delim, double *out) {
+    const char *start = *pp, *p = start;
+    while (p < e && *p == ' ') {
+        p++;
     }
-    
-    // Skip leading whitespace
-    char ch;
-    int result;
-    do {
-        result = mygetc(m, &ch);
-        if (result == -1) {
-            DPRINT("EOF reached while skipping whitespace\n");
-            return NULL;
+    int neg = p < e && *p == '-';
+    if (p < e && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    uint64_t mant = 0;
+    size_t idig = mio_digits(&p, e, &mant, 19), fdig = 0;
+    if (p < e && *p == '.') {
+        p++;
+        fdig = mio_digits(&p, e, &mant, idig < 19 ? 19 - idig : 0);
+    }
+    long exp10 = 0;
+    int expok = 1;
+    if ((idig || fdig) && p < e && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        int eneg = q < e && *q == '-';
+        if (q < e && (*q == '-' || *q == '+')) {
+            q++;
         }
-    } while (M_ISWS(ch));
-    
-    // Allocate buffer for the string
-    char *buffer = malloc(MBSIZE);
-    if (!buffer) {
-        DPRINT("Failed to allocate string buffer\n");
-        return NULL;
+        uint64_t ev = 0;
+        size_t en = mio_digits(&q, e, &ev, 6);
+        expok = en > 0 && en <= 6;
+        exp10 = eneg ? -(long)ev : (long)ev;
+        p = q;
     }
     
-    int pos = 0;
-    buffer[pos++] = ch;  // Add the first non-whitespace character
-    
-    // Read until next whitespace or buffer full
-    while (pos < MBSIZE - 1) {
-        result = mygetc(m, &ch);
-        if (result != 1) {
-            break;  // EOF or error
+    int term = p == e || *p == delim || *p == '\n' || *p == '\r' || *p == ' ';
+    if ((idig || fdig) && expok && term && idig + fdig <= 19 && mant <= (1ULL << 53)) {
+        exp10 -= (long)fdig;
+        if (exp10 >= -22 && exp10 <= 22) {
+            double d = (double)mant;
+            d = exp10 < 0 ? d / mio_pow10[-exp10] : d * mio_pow10[exp10];
+            *out = neg ? -d : d;
+            *pp = p;
+            return 0;
         }
-        
-        // Stop at whitespace
-        if (M_ISWS(ch)) {
-            break;
-        }
-        
-        buffer[pos++] = ch;
     }
     
-    buffer[pos] = '\0';  // Null terminate the string
-    
-    if (len) {
-        *len = pos;
+    // slow path on a NUL-terminated copy of the field
+    char buf[128];
+    const char *fe = start;
+    while (fe < e && *fe != delim && *fe != '\n' && *fe != '\r') {
+        fe++;
     }
-    
-    DPRINT("Read string: '%s' (length: %d)\n", buffer, pos);
-    return buffer;
+    if (fe - start >= (long)sizeof(buf)) {
+        *pp = fe;
+        return -1;
+    }
+    memcpy(buf, start, (size_t)(fe - start));
+    buf[fe - start] = '\0';
+    char *end;
+    errno = 0;
+    *out = strtod(buf, &end);
+    *pp = start + (end - buf);
+    return end == buf || errno == ERANGE ? -1 : 0;
 }
 
-// Write data to file
-int mywrite(MIO *m, const char *b, const int size) {
-    if (!m || !b || size < 0) {
-        DPRINT("Invalid parameters to mywrite\n");
-        return -1;
+static void mio_load_lines(struct mio_load_part *pt) {
+    const char *p = pt->b, *e = pt->e;
+    char delim = pt->delim;
+    for (size_t row = pt->row0; p < e; row++) {
+        for (int c = 0; c < pt->ncols; c++) {
+            const struct mio_column *col = &pt->cols[c];
+            int64_t iv = 0;
+            double dv = NAN;
+            int ok = 1;
+            switch (col->type) {
+                case MIO_COL_I32:
+                    ok = mio_parse_int(&p, e, INT32_MIN, INT32_MAX, &iv) == 0;
+                    ((int32_t *)col->data)[row] = ok ? (int32_t)iv : 0;
+                    break;
+                case MIO_COL_I64:
+                    ok = mio_parse_int(&p, e, INT64_MIN, INT64_MAX, &iv) == 0;
+                    ((int64_t *)col->data)[row] = ok ? iv : 0;
+                    break;
+                case MIO_COL_F64:
+                    ok = mio_parse_double(&p, e, delim, &dv) == 0;
+                    ((double *)col->data)[row] = ok ? dv : NAN;
+                    break;
+                default:
+                    while (p < e && *p != delim && *p != '\n') {
+                        p++;
+                    }
+            }
+            
+            // the field must end here, at a delimiter or the end of the line
+            while (p < e && (*p == ' ' || *p == '\r')) {
+                p++;
+            }
+            if (p < e && *p != delim && *p != '\n') {
+                ok = 0;
+                while (p < e && *p != delim && *p != '\n') {
+                    p++;
+                }
+            }
+            if (!ok) {
+                if (col->type == MIO_COL_I32) {
+                    ((int32_t *)col->data)[row] = 0;
+                } else if (col->type == MIO_COL_I64) {
+                    ((int64_t *)col->data)[row] = 0;
+                } else if (col->type == MIO_COL_F64) {
+                    ((double *)col->data)[row] = NAN;
+                }
+                if (pt->errors++ == 0) {
+                    pt->first_row = row;
+                    pt->first_col = c;
+                }
+            }
+            if (p < e && *p == delim) {
+                p++;
+            }
+        }
+        // fields past the described columns are ignored
+        const char *nl = memchr(p, '\n', (size_t)(e - p));
+        p = nl ? nl + 1 : e;
     }
-    
-    if (!M_ISMW(m->rw)) {
-        DPRINT("File not opened for writing\n");
+}
+
+static void *mio_load_main(void *arg) {
+    mio_load_lines(arg);
+    return NULL;
+}
+
+// Parse delimited numeric text into the caller's column arrays: the first
+// ncols fields of each line go to cols[i].data (int32_t, int64_t or double
+// arrays of at least maxrows entries; MIO_COL_SKIP fields are ignored).
+// Chunks are parsed on up to nthreads threads. Fields that do not parse are
+// stored as 0 (NAN for doubles) and counted in *st. Stops after maxrows
+// lines, leaving the rest to read; returns the lines loaded or -1. On a
+// non-blocking handle the complete lines that have arrived are loaded and an
+// unfinished one is kept for the next call; MIO_WOULDBLOCK if there are none.
+ssize_t myload_columns(MIO *m, char delim, const struct mio_column *cols, int ncols,
+                       size_t maxrows, int nthreads, struct mio_load_stats *st) {
+    if (!m || m->rw != MODE_R || !cols || ncols < 1 || delim == '\n' ||
+        nthreads < 1 || nthreads > MIO_WORKERS_MAX || maxrows > SSIZE_MAX) {
+        DPRINT("Invalid parameters to myload_columns\n");
+        errno = EINVAL;
         return -1;
     }
+    for (int c = 0; c < ncols; c++) {
+        if (cols[c].type != MIO_COL_SKIP && !cols[c].data) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
     
-    int total_written = 0;
-    
-    while (total_written < size) {
-        int available = m->wsize - m->ws;
-        int remaining = size - total_written;
-        int to_copy = (available < remaining) ? available : remaining;
+    struct mio_load_part parts[MIO_WORKERS_MAX];
+    pthread_t tids[MIO_WORKERS_MAX];
+    size_t rows = 0, errors = 0, first_row = 0;
+    int first_col = -1;
+    size_t want = MIO_LOAD_CHUNK;
+    int blocked = 0;
+    while (rows < maxrows && !blocked) {
+        ssize_t have = mio_fill(m, want);
+        if (have == MIO_WOULDBLOCK) {
+            // load what has arrived
+            have = (ssize_t)(m->re - m->rs);
+            blocked = 1;
+        } else if (have < 0) {
+            return -1;
+        }
+        if (have == 0) {
+            break;
+        }
+        const char *b = m->rb + m->rs, *end = b + have;
+        int eof = !blocked && (size_t)have < want;
+        const char *nl = memrchr(b, '\n', (size_t)have);
+        const char *stop = eof ? end : nl ? nl + 1 : NULL;
+        if (!stop) {
+            if (blocked) {
+                break;
+            }
+            want *= 2;  // a line longer than the chunk
+            continue;
+        }
         
-        // Copy data to write buffer
-        memcpy(m->wb + m->ws, b + total_written, to_copy);
-        m->ws += to_copy;
-        total_written += to_copy;
+        // one part per thread, split at newlines; small chunks are not split
+        int nparts = (size_t)(stop - b) >= (size_t)nthreads * (1 << 16) ? nthreads : 1;
+        const char *pb = b;
+        int k;
+        for (k = 0; k < nparts && pb < stop && rows < maxrows; k++) {
+            const char *pe = stop;
+            if (k < nparts - 1) {
+                const char *cut = b + (size_t)(stop - b) * (size_t)(k + 1) / (size_t)nparts;
+                const char *q = cut > pb ? memchr(cut, '\n', (size_t)(stop - cut)) : NULL;
+                pe = q ? q + 1 : stop;
+            }
+            size_t lines = mio_count_records(pb, (size_t)(pe - pb)) + (pe[-1] != '\n');
+            if (lines > maxrows - rows) {
+                // end the part after the last line that fits
+                lines = maxrows - rows;
+                pe = pb;
+                for (size_t i = 0; i < lines; i++) {
+                    const char *q = memchr(pe, '\n', (size_t)(stop - pe));
+                    pe = q ? q + 1 : stop;
+                }
+            }
+            parts[k] = (struct mio_load_part){ cols, ncols, delim, pb, pe, rows, 0, 0, -1 };
+            rows += lines;
+            pb = pe;
+        }
+        nparts = k;
         
-        // If buffer is full, flush it
-        if (m->ws >= m->wsize) {
-            if (myflush(m) < 0) {
-                DPRINT("Failed to flush buffer during write\n");
-                return -1;
+        int started = 0;
+        for (k = 1; k < nparts; k++) {
+            if (pthread_create(&tids[k], NULL, mio_load_main, &parts[k]) != 0) {
+                break;
+            }
+            started = k;
+        }
+        mio_load_lines(&parts[0]);
+        for (k = started + 1; k < nparts; k++) {
+            mio_load_lines(&parts[k]);  // threads that could not be started
+        }
+        for (k = 1; k <= started; k++) {
+            pthread_join(tids[k], NULL);
+        }
+        for (k = 0; k < nparts; k++) {
+            if (parts[k].errors && errors == 0) {
+                first_row = parts[k].first_row;
+                first_col = parts[k].first_col;
             }
+            errors += parts[k].errors;
         }
+        
+        m->pos += (off_t)(pb - b);
+        m->rs += (size_t)(pb - b);
+        want = MIO_LOAD_CHUNK;
     }
     
-    DPRINT("Buffered %d bytes for writing\n", total_written);
-    return total_written;
+    if (st) {
+        st->errors = errors;
+        st->first_row = first_row;
+        st->first_col = first_col;
+    }
+    DPRINT("Loaded %zu rows, %zu bad fields\n", rows, errors);
+    return blocked && rows == 0 ? MIO_WOULDBLOCK : (ssize_t)rows;
 }
 
-// Flush write buffer to file
-int myflush(MIO *m) {
-    if (!m) {
-        DPRINT("Invalid MIO pointer to myflush\n");
-        return -1;
+// Typed binary I/O. Values are converted between rb/wb and the caller's
+// arrays in one pass; byte order is swapped with pshufb where available.
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define MIO_HOST_ORDER MIO_BE
+#else
+#define MIO_HOST_ORDER MIO_LE
+#endif
+
+static void mio_swap_sw(char *dst, const char *src, size_t n, size_t w) {
+    for (size_t i = 0; i < n; i++, dst += w, src += w) {
+        if (w == 2) {
+            uint16_t v;
+            memcpy(&v, src, 2);
+            v = __builtin_bswap16(v);
+            memcpy(dst, &v, 2);
+        } else if (w == 4) {
+            uint32_t v;
+            memcpy(&v, src, 4);
+            v = __builtin_bswap32(v);
+            memcpy(dst, &v, 4);
+        } else {
+            uint64_t v;
+            memcpy(&v, src, 8);
+            v = __builtin_bswap64(v);
+            memcpy(dst, &v, 8);
+        }
     }
-    
-    if (!M_ISMW(m->rw)) {
-        DPRINT("File opened for reading, nothing to flush\n");
-        return 0;
+}
+
+static void (*mio_swap)(char *dst, const char *src, size_t n, size_t w);
+static pthread_once_t mio_swap_once = PTHREAD_ONCE_INIT;
+
+#if defined(__x86_64__) || defined(__i386__)
+// SSSE3 pshufb, 32 bytes per step
+__attribute__((target("ssse3")))
+static void mio_swap_ssse3(char *dst, const char *src, size_t n, size_t w) {
+    __m128i mask = w == 2 ? _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14) :
+                   w == 4 ? _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12) :
+                            _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t bytes = n * w, i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(a, mask));
+        _mm_storeu_si128((__m128i *)(dst + i + 16), _mm_shuffle_epi8(b, mask));
     }
-    
-    if (m->ws == 0) {
-        DPRINT("Write buffer is empty, nothing to flush\n");
-        return 0;
+    if (i + 16 <= bytes) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(a, mask));
+        i += 16;
     }
-    
-    // Write the entire buffer to file
-    int written = write(m->fd, m->wb, m->ws);
-    if (written < 0) {
-        DPRINT("Write error during flush: %s\n", strerror(errno));
-        return -1;
+    mio_swap_sw(dst + i, src + i, (bytes - i) / w, w);
+}
+#endif
+
+static void mio_swap_init(void) {
+    mio_swap = mio_swap_sw;
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("ssse3")) {
+        mio_swap = mio_swap_ssse3;
     }
-    
-    if (written != m->ws) {
-        DPRINT("Partial write during flush: %d of %d bytes\n", written, m->ws);
-        // Handle partial write by moving remaining data to front
-        if (written > 0) {
-            memmove(m->wb, m->wb + written, m->ws - written);
-            m->ws -= written;
-        }
-        return written;
+#endif
+}
+
+static void mio_convert(char *dst, const char *src, size_t n, size_t w, int order) {
+    if (order == MIO_HOST_ORDER || w == 1) {
+        memcpy(dst, src, n * w);
+    } else {
+        mio_swap(dst, src, n, w);
     }
-    
-    // Reset write position after successful flush
-    m->ws = 0;
-    DPRINT("Successfully flushed %d bytes to file\n", written);
-    return written;
 }
 
-// Write single character to file
-int myputc(MIO *m, const char c) {
-    if (!m) {
-        DPRINT("Invalid MIO pointer to myputc\n");
+// Read n values of w bytes stored in 'order'; returns the values read, or
+// -1 at EOF. A partial value at the end of the data is left unread.
+static ssize_t mio_read_array(MIO *m, void *dst, size_t n, size_t w, int order) {
+    if (!m || (!dst && n) || m->rw != MODE_R || (order != MIO_LE && order != MIO_BE) ||
+        n > SSIZE_MAX / w) {
+        DPRINT("Invalid parameters to typed read\n");
+        errno = EINVAL;
         return -1;
     }
+    pthread_once(&mio_swap_once, mio_swap_init);
     
-    // Use mywrite to write one character
-    int result = mywrite(m, &c, 1);
-    if (result == 1) {
-        DPRINT("Wrote character: %c\n", c);
-    } else {
-        DPRINT("Failed to write character\n");
+    char *d = dst;
+    size_t done = 0;
+    while (done < n) {
+        ssize_t have = mio_fill(m, w);
+        if (have < 0) {
+            return done > 0 ? (ssize_t)done : have;
+        }
+        size_t k = (size_t)have / w;
+        if (k == 0) {
+            break;
+        }
+        if (k > n - done) {
+            k = n - done;
+        }
+        mio_convert(d + done * w, m->rb + m->rs, k, w, order);
+        m->rs += k * w;
+        m->pos += (off_t)(k * w);
+        done += k;
     }
-    return result;
+    DPRINT("Read %zu of %zu %zu-byte values\n", done, n, w);
+    return done > 0 || n == 0 ? (ssize_t)done : -1;
 }
 
-// Write string to file
-int myputs(MIO *m, const char *str, const int len) {
-    if (!m || !str || len < 0) {
-        DPRINT("Invalid parameters to myputs\n");
+// Write n values of w bytes in 'order', converting straight into wb
+static ssize_t mio_write_array(MIO *m, const void *src, size_t n, size_t w, int order) {
+    if (!m || (!src && n) || !M_ISMW(m->rw) || (order != MIO_LE && order != MIO_BE) ||
+        n > SSIZE_MAX / w) {
+        DPRINT("Invalid parameters to typed write\n");
+        errno = EINVAL;
         return -1;
     }
+    pthread_once(&mio_swap_once, mio_swap_init);
     
-    // Use mywrite to write the entire string
-    int result = mywrite(m, str, len);
-    if (result == len) {
-        DPRINT("Successfully wrote string of length %d\n", len);
-    } else {
-        DPRINT("Failed to write complete string: %d of %d bytes\n", result, len);
+    const char *s = src;
+    size_t done = 0;
+    while (done < n) {
+        // what fits without flushing; when not even one value does, drain
+        // first and take what that frees (direct handles keep their tail)
+        size_t tail, k = mio_wfree(m, &tail) / w;
+        if (k == 0 && m->ws > 0 && !(m->flags & MIO_MEM)) {
+            ssize_t flushed = mio_wdrain(m);
+            if (flushed < 0 && flushed != MIO_WOULDBLOCK) {
+                return done > 0 ? (ssize_t)done : -1;
+            }
+            k = mio_wfree(m, &tail) / w;
+        }
+        if (k == 0) {
+            k = 1;
+        }
+        if (k > n - done) {
+            k = n - done;
+        }
+        char *p = mywrite_reserve(m, k * w);
+        if (!p) {
+            if (done > 0) {
+                return (ssize_t)done;
+            }
+            return (m->flags & MIO_NONBLOCK) && errno == EAGAIN ? MIO_WOULDBLOCK : -1;
+        }
+        mio_convert(p, s + done * w, k, w, order);
+        int committed = mywrite_commit(m, k * w);
+        done += k;  // in the stream even if the flush after the commit failed
+        if (committed < 0) {
+            return (ssize_t)done;
+        }
     }
-    return result;
+    return (ssize_t)done;
 }
+
+// 0, or -1 at EOF or on error; MIO_WOULDBLOCK from non-blocking handles
+#define MIO_TYPED(T, bits, sfx, order) \
+    int myread_u##bits##sfx(MIO *m, T *v) { \
+        ssize_t r = mio_read_array(m, v, 1, sizeof(T), order); \
+        return r == 1 ? 0 : r == MIO_WOULDBLOCK ? MIO_WOULDBLOCK : -1; \
+    } \
+    int mywrite_u##bits##sfx(MIO *m, T v) { \
+        ssize_t r = mio_write_array(m, &v, 1, sizeof(T), order); \
+        return r == 1 ? 0 : r == MIO_WOULDBLOCK ? MIO_WOULDBLOCK : -1; \
+    }
+
+MIO_TYPED(uint16_t, 16, le, MIO_LE)
+MIO_TYPED(uint16_t, 16, be, MIO_BE)
+MIO_TYPED(uint32_t, 32, le, MIO_LE)
+MIO_TYPED(uint32_t, 32, be, MIO_BE)
+MIO_TYPED(uint64_t, 64, le, MIO_LE)
+MIO_TYPED(uint64_t, 64, be, MIO_BE)
+
+// Bulk variants: return the values transferred, or -1 (MIO_WOULDBLOCK from
+// non-blocking handles when none could be)
+#define MIO_TYPED_ARRAY(T, bits) \
+    ssize_t myread_u##bits##_array(MIO *m, T *dst, size_t n, int order) { \
+        return mio_read_array(m, dst, n, sizeof(T), order); \
+    } \
+    ssize_t mywrite_u##bits##_array(MIO *m, const T *src, size_t n, int order) { \
+        return mio_write_array(m, src, n, sizeof(T), order); \
+    }
+
+MIO_TYPED_ARRAY(uint16_t, 16)
+MIO_TYPED_ARRAY(uint32_t, 32)
+MIO_TYPED_ARRAY(uint64_t, 64)
@@ -1,24 +1,83 @@
 #ifndef MIO_H_
 #define MIO_H_
+// 64-bit off_t also on 32-bit targets (include mio.h before system headers)
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <stdint.h>
 
 #include "dprint.h"
 
 // Defined Constants
-#define MBSIZE 10	// default size for buffers
+#ifndef MBSIZE
+#define MBSIZE 10	// default size for buffers (override with -DMBSIZE=n)
+#endif
 #define MODE_R 0	// read only
 #define MODE_WA 1	// write only create/append
 #define MODE_WT 2	// write only truncate
+#define MODE_DIRECT 0x10	// flag for any mode: O_DIRECT with aligned buffers
+#define MODE_FOLLOW 0x20	// flag for MODE_R: wait for the file to grow at EOF
+#define MODE_INDEXED 0x40	// flag for MODE_R/MODE_WT: block-indexed container
+#define MIO_DIRECT_ALIGN 4096	// O_DIRECT alignment when the fs does not report one
+#define MIO_DIRECT_BSIZE (1 << 20)	// O_DIRECT buffer size (rounded to the alignment)
+#define MIO_CACHELINE 64	// alignment of pooled handle blocks
+#define MIO_POOL_BINS 4	// distinct buffer sizes cached per thread
+#define MIO_POOL_DEPTH 64	// released handles cached per buffer size
+#define MIO_MEMHDR 64	// header in front of growable memory stream buffers
+#define MIO_MEMSTREAM_INIT 256	// initial capacity of a growable memory stream
+#define MIO_MEMMAP_MIN (1 << 20)	// memory streams this large use mmap/mremap
+#define MIO_WOULDBLOCK -2	// non-blocking handle: the call would have to wait
+#define MIO_WANT_READ 0x1	// myinterest(): same value as POLLIN/EPOLLIN
+#define MIO_WANT_WRITE 0x4	// myinterest(): same value as POLLOUT/EPOLLOUT
+#define MIO_IOV_MAX 64	// segments handled in one myreadv()/mywritev() syscall
+#define MIO_REVERSE_BSIZE (1 << 16)	// aligned block size of mygetline_reverse() reads
+#define MIO_CACHE_PAGE (1 << 16)	// block cache page size
+#define MIO_CACHE_SHARDS 16	// block cache shards, each with its own lock
+#define MIO_CACHE_MIN (MIO_CACHE_PAGE * MIO_CACHE_SHARDS)	// smallest cache bound: a page per shard
+#define MIO_FILTER_MAX 4	// filters per handle
+#define MIO_FILTER_BSIZE (1 << 16)	// largest frame (raw bytes) of filtered handles
+#define MIO_FRAME_HDR 8	// frame header: rawlen and enclen, 32-bit little-endian
+#define MIO_WORKERS_MAX 64	// compression threads per handle
+#define MIO_VARINT_MAX 10	// longest varint record length prefix
+#define MIO_LOAD_CHUNK (1 << 22)	// text parsed per round by myload_columns()
 #define MTAB '\t'	// Tab
 #define MNLINE '\n'	// Newline
 #define MCRET '\r'	// Carriage return
 #define MSPACE ' '	// Space
 
+// Handle flags
+#define MIO_POOLED 0x1	// struct and buffers share one pooled block
+#define MIO_OWNRB 0x2	// rb allocated separately from the handle block
+#define MIO_DIRECT 0x4	// opened with MODE_DIRECT
+#define MIO_MEM 0x8	// buffers are a caller memory region, no fd
+#define MIO_GROW 0x10	// growable memory stream, see mymemstream()
+#define MIO_NONBLOCK 0x20	// non-blocking mode, see mysetnonblock()
+#define MIO_OWNWB 0x40	// wb allocated separately from the handle block
+#define MIO_FOLLOW 0x80	// opened with MODE_FOLLOW
+#define MIO_CACHED 0x100	// refills go through the block cache
+#define MIO_DIGEST 0x200	// digests enabled, see mysetdigest()
+#define MIO_FILTER 0x400	// filter stack pushed, see mypushfilter()
+#define MIO_PARALLEL 0x800	// frames compressed by worker threads, see mysetworkers()
+#define MIO_INDEXED 0x1000	// opened with MODE_INDEXED
+#define MIO_RECCRC 0x2000	// records carry a CRC32C, see mysetrecordcrc()
+
+// Digests, see mysetdigest()
+#define MIO_DIGEST_CRC32C 0x1	// CRC32C (SSE4.2 when available)
+#define MIO_DIGEST_XXH64 0x2	// XXH64, seed 0
+
+// Buffering policies, see mysetvbuf()
+#define MIO_FULLBUF 0	// flush when wb is full (default)
+#define MIO_LINEBUF 1	// also flush after writes containing a newline
+#define MIO_NOBUF 2	// flush at the end of every write
+#define MIO_TIMEBUF 3	// also flush when data sat in wb longer than maxdelay
+
 // Macros
 // Is char X whitespace: 1 - yes, 0 - no
 #define M_ISWS(X) (((X==MTAB)||(X==MNLINE)||(X==MSPACE)||(X==MCRET)) ? (1) : (0))
@@ -30,25 +89,204 @@ struct _mio {
 	int fd;			// file descriptor
 	int rw;			// 0 - read, 1 - write append, 2 - write truncate
 	char *rb, *wb;		// buffers
-	int rsize, wsize;	// buffer sizes
-	int rs, re, ws, we;	// buffer indices
+	size_t rsize, wsize;	// buffer sizes
+	size_t rs, re, ws, we;	// buffer indices (ws - bytes pending in wb)
+	size_t wh;		// head of the pending data in the ring wb
+	size_t wres;		// bytes reserved by mywrite_reserve() (0 - none)
+	size_t wresoff;		// where the reservation starts in wb
+	off_t pos;		// stream offset of the next byte read or written
+	int flags;		// MIO_* handle flags
+	size_t psize;		// buffer size of the pooled block
+	size_t dalign;		// O_DIRECT transfer alignment
+	char **mbufp;		// memory stream owner's buffer pointer
+	size_t *msizep;		// memory stream owner's length
+	int bufmode;		// MIO_FULLBUF, MIO_LINEBUF, MIO_NOBUF or MIO_TIMEBUF
+	long maxdelay;		// MIO_TIMEBUF latency bound in microseconds
+	long long wsince;	// when the oldest byte in wb was written (0 - empty)
+	char *path;		// MODE_FOLLOW: file name, reopened after rotation
+	int ifd, iwd;		// MODE_FOLLOW: inotify descriptor and file watch
+	int ftimeout;		// MODE_FOLLOW: wait at EOF in ms (-1 - forever)
+	dev_t dev;		// block cache key of the file
+	ino_t ino;
+	struct timespec mtime;	// file version the cached blocks must match
+	struct mio_digest *dg;	// running digests (MIO_DIGEST)
+	struct mio_fstack *fs;	// filter stack (MIO_FILTER)
+	char *spill;		// myreadrecord(): records larger than rb
+	size_t spillcap;
+	size_t spillhave, spillneed;	// record being spilled (0 - none)
 };
 typedef struct _mio MIO;
 
+// Caller memory that mygets_batch() copies tokens into; reset used to reuse
+struct mio_arena {
+	char *base;
+	size_t size, used;
+};
+
+// A token returned by mygets_batch(), NUL-terminated in the arena
+struct mio_token {
+	const char *ptr;
+	size_t len;
+};
+
+// A field returned by mycsv_row(): a view into the read buffer (or into the
+// reader's scratch for quoted fields with "" escapes), not NUL-terminated
+struct mio_field {
+	const char *ptr;
+	size_t len;
+};
+struct mio_csv;
+
+// Byte orders for the typed binary functions
+#define MIO_LE 0	// little-endian
+#define MIO_BE 1	// big-endian
+
+// Column types for myload_columns()
+#define MIO_COL_SKIP 0	// field ignored, data may be NULL
+#define MIO_COL_I32 1	// int32_t array
+#define MIO_COL_I64 2	// int64_t array
+#define MIO_COL_F64 3	// double array
+
+// One destination column of myload_columns()
+struct mio_column {
+	int type;		// MIO_COL_*
+	void *data;		// caller array of at least maxrows entries
+};
+
+// Fields myload_columns() could not parse
+struct mio_load_stats {
+	size_t errors;
+	size_t first_row;	// row and column of the first one
+	int first_col;		// (-1 - none)
+};
+
+// Block transform between the buffers and the fd, see mypushfilter().
+// encode/decode return the output length, or -1 when the input is invalid
+// or does not fit in cap bytes; bound gives the largest encoding of n bytes.
+struct mio_filter {
+	const char *name;
+	void *ctx;		// passed to every callback
+	size_t (*bound)(void *ctx, size_t n);
+	ssize_t (*encode)(void *ctx, const char *src, size_t n, char *dst, size_t cap);
+	ssize_t (*decode)(void *ctx, const char *src, size_t n, char *dst, size_t cap);
+};
+extern const struct mio_filter mio_filter_lz;	// LZ4 block format compression
+extern const struct mio_filter mio_filter_crc;	// CRC32C per frame, verified on read
+
+// One block (frame) of a MODE_INDEXED container
+struct mio_block {
+	off_t offset;		// file offset of the frame header
+	off_t rawoff;		// offset of the block in the decoded stream
+	size_t rawlen, enclen;	// decoded and stored sizes
+	size_t records;		// lines in the block
+};
+
+// Block cache counters, see mycache_stats()
+struct mio_cache_stats {
+	long hits, misses;	// page lookups
+	long evictions;		// pages replaced by CLOCK
+	long pages;		// pages holding data
+};
+
 // open/close functions
 MIO *myopen(const char *name, const int mode);
+MIO *myfdopen(int fd, int mode);
+MIO *mymemopen(void *buf, size_t len, int mode);
+MIO *mymemstream(char **bufp, size_t *sizep);
+void mymemfree(char *buf);
 int myclose(MIO *m);
+void mypool_trim(void);
+int mycache_init(size_t bytes);
+void mycache_stats(struct mio_cache_stats *st);
 
 // read functions
 int myread(MIO *m, char *b, const int size);
+ssize_t myread64(MIO *m, char *b, size_t size);
 int mygetc(MIO *m, char *c);
 char *mygets(MIO *m, int *len);
+char *mygetline(MIO *m, size_t *len);
+char *mygetline_reverse(MIO *m, size_t *len);
+ssize_t mygets_batch(MIO *m, struct mio_token *out, size_t max, struct mio_arena *arena);
+ssize_t mypeek(MIO *m, size_t n, const char **p);
+int myungetc(MIO *m, char c);
+ssize_t myskip(MIO *m, size_t n);
+int myreadv(MIO *m, const struct iovec *iov, int iovcnt);
 
 // write functions
 int mywrite(MIO *m, const char *b, const int size);
+ssize_t mywrite64(MIO *m, const char *b, size_t size);
 int myflush(MIO *m);
 int myputc(MIO *m, const char c);
 int myputs(MIO *m, const char *str, const int len);
+ssize_t myputs64(MIO *m, const char *str, size_t len);
+int mywritev(MIO *m, const struct iovec *iov, int iovcnt);
+char *mywrite_reserve(MIO *m, size_t n);
+int mywrite_commit(MIO *m, size_t used);
+
+// position functions
+off_t mytell(MIO *m);
+off_t myseek(MIO *m, off_t offset, int whence);
+
+// buffering policy functions
+int mysetvbuf(MIO *m, int mode, size_t size);
+int mysetlatency(MIO *m, long usec);
+int mytick(MIO *m);
+
+// digest functions
+int mysetdigest(MIO *m, int which);
+int mydigest(MIO *m, uint32_t *crc32c, uint64_t *xxh64);
+
+// filter functions
+int mypushfilter(MIO *m, const struct mio_filter *f);
+int mysetworkers(MIO *m, int nthreads);
+
+// delimited text functions
+struct mio_csv *mycsv_open(MIO *m, char delim);
+int mycsv_project(struct mio_csv *c, const int *cols, int ncols);
+ssize_t mycsv_row(struct mio_csv *c, const struct mio_field **fields);
+void mycsv_close(struct mio_csv *c);
+
+// typed binary functions
+int myread_u16le(MIO *m, uint16_t *v);
+int myread_u16be(MIO *m, uint16_t *v);
+int myread_u32le(MIO *m, uint32_t *v);
+int myread_u32be(MIO *m, uint32_t *v);
+int myread_u64le(MIO *m, uint64_t *v);
+int myread_u64be(MIO *m, uint64_t *v);
+int mywrite_u16le(MIO *m, uint16_t v);
+int mywrite_u16be(MIO *m, uint16_t v);
+int mywrite_u32le(MIO *m, uint32_t v);
+int mywrite_u32be(MIO *m, uint32_t v);
+int mywrite_u64le(MIO *m, uint64_t v);
+int mywrite_u64be(MIO *m, uint64_t v);
+ssize_t myread_u16_array(MIO *m, uint16_t *dst, size_t n, int order);
+ssize_t myread_u32_array(MIO *m, uint32_t *dst, size_t n, int order);
+ssize_t myread_u64_array(MIO *m, uint64_t *dst, size_t n, int order);
+ssize_t mywrite_u16_array(MIO *m, const uint16_t *src, size_t n, int order);
+ssize_t mywrite_u32_array(MIO *m, const uint32_t *src, size_t n, int order);
+ssize_t mywrite_u64_array(MIO *m, const uint64_t *src, size_t n, int order);
+
+// columnar numeric loading
+ssize_t myload_columns(MIO *m, char delim, const struct mio_column *cols, int ncols,
+                       size_t maxrows, int nthreads, struct mio_load_stats *st);
+
+// record framing functions
+int mysetrecordcrc(MIO *m, int on);
+ssize_t mywriterecord(MIO *m, const void *data, size_t len);
+int myreadrecord(MIO *m, const void **ptr, size_t *len);
+
+// block-indexed container functions
+size_t mynblocks(MIO *m);
+int myblockinfo(MIO *m, size_t block, struct mio_block *info);
+off_t myseekblock(MIO *m, size_t block);
+ssize_t mypreadblock(MIO *m, size_t block, char *dst, size_t cap);
+
+// non-blocking / event loop functions
+int mysetnonblock(MIO *m, int on);
+int mysetfollow(MIO *m, int timeout_ms);
+int myfileno(MIO *m);
+int myinterest(MIO *m);
+int mydrive(MIO *m);
 
 #endif
 